@@ -0,0 +1,154 @@
+#pragma once
+
+// alarms.h
+//
+// Table-driven threshold alarms, evaluated once per control sample at a
+// fixed cost per rule: a counter and a timestamp for threshold rules, a
+// running min/max for ripple rules. No history is kept.
+//
+//   threshold: current, current as a percentage of the active limit,
+//              voltage or |setpoint - current| above or below a threshold
+//              for at least `samples` consecutive samples and at least
+//              hold_ms milliseconds.
+//   ripple:    peak-to-peak current or voltage over blocks of `samples`
+//              samples, checked at the end of each block. A setpoint change
+//              restarts the block, and the block after it is only used to
+//              let the step settle, so deliberate steps never count as
+//              ripple.
+//
+// A rule that trips stays latched until clear(), so a brief excursion is
+// still visible after it has passed.
+
+#include <math.h>
+#include <stdint.h>
+
+#define ALARM_MAX_RULES 8
+
+enum AlarmQuantity : uint8_t {
+  ALARM_CURRENT,
+  ALARM_VOLTAGE,
+  ALARM_SETPOINT_ERROR,   // |setpoint - current|, mA
+  ALARM_CURRENT_RIPPLE,   // Peak-to-peak mA per block
+  ALARM_VOLTAGE_RIPPLE,   // Peak-to-peak V per block
+  ALARM_CURRENT_OF_LIMIT, // % of the active limit, so it follows runtime changes
+};
+
+enum AlarmCondition : uint8_t {
+  ALARM_ABOVE,
+  ALARM_BELOW,
+};
+
+const char *alarmQuantityName(uint8_t quantity) {
+  static const char *const names[] = {"current", "voltage", "setpoint_error", "current_ripple", "voltage_ripple",
+                                       "current_of_limit"};
+  return quantity < sizeof(names) / sizeof(names[0]) ? names[quantity] : "unknown";
+}
+
+struct AlarmRule {
+  AlarmQuantity quantity;
+  AlarmCondition condition;
+  float threshold;
+  uint16_t samples; // Consecutive samples, or the block length for ripple
+  uint32_t hold_ms; // Minimum duration as well; threshold rules only
+  bool safeOutput;  // Hold the safe output while latched
+};
+
+class AlarmEngine {
+public:
+  void begin(const AlarmRule *rules, uint8_t count) {
+    this->rules = rules;
+    this->count = count < ALARM_MAX_RULES ? count : ALARM_MAX_RULES;
+    clear();
+  }
+
+  // Returns a bit mask of the rules that latched on this sample.
+  uint32_t update(uint32_t now_us, float current_mA, float voltage_V, float setpoint_mA, float limit_mA) {
+    uint32_t raised = 0;
+    bool setpointChanged = setpoint_mA != lastSetpoint_mA;
+    lastSetpoint_mA = setpoint_mA;
+    for (uint8_t i = 0; i < count; i++) {
+      const AlarmRule &rule = rules[i];
+      RuleState &state = states[i];
+      if (latched & (1u << i)) continue;
+
+      float value;
+      switch (rule.quantity) {
+        case ALARM_CURRENT_RIPPLE:
+        case ALARM_VOLTAGE_RIPPLE: {
+          if (setpointChanged) {
+            state.run = 0;
+            state.settling = true;
+            continue;
+          }
+          float x = rule.quantity == ALARM_CURRENT_RIPPLE ? current_mA : voltage_V;
+          if (state.run == 0 || x < state.lowest) state.lowest = x;
+          if (state.run == 0 || x > state.highest) state.highest = x;
+          if (++state.run < rule.samples) continue;
+          state.run = 0;
+          if (state.settling) {
+            state.settling = false;
+            continue;
+          }
+          value = state.highest - state.lowest;
+          if (value <= rule.threshold) continue;
+          latch(i, value);
+          raised |= 1u << i;
+          continue;
+        }
+        case ALARM_CURRENT: value = current_mA; break;
+        case ALARM_VOLTAGE: value = voltage_V; break;
+        case ALARM_CURRENT_OF_LIMIT: value = limit_mA > 0 ? current_mA * 100.0f / limit_mA : 0; break;
+        default: value = fabsf(setpoint_mA - current_mA); break;
+      }
+      bool met = rule.condition == ALARM_ABOVE ? value > rule.threshold : value < rule.threshold;
+      if (!met) {
+        state.run = 0;
+        continue;
+      }
+      if (state.run == 0) state.since_us = now_us;
+      if (state.run < UINT16_MAX) state.run++;
+      if (state.run >= rule.samples && now_us - state.since_us >= rule.hold_ms * 1000) {
+        latch(i, value);
+        raised |= 1u << i;
+      }
+    }
+    return raised;
+  }
+
+  void clear() {
+    latched = 0;
+    holdSafe = false;
+    for (uint8_t i = 0; i < ALARM_MAX_RULES; i++) states[i].run = 0;
+  }
+
+  uint32_t getLatched() const { return latched; }
+  bool holdsSafeOutput() const { return holdSafe; }
+  uint8_t getCount() const { return count; }
+  const AlarmRule &getRule(uint8_t i) const { return rules[i]; }
+  float getTripValue(uint8_t i) const { return states[i].tripValue; } // Value that latched rule i
+  uint32_t getTrips(uint8_t i) const { return states[i].trips; }
+
+private:
+  struct RuleState {
+    uint16_t run = 0;      // Consecutive samples met, or samples in the ripple block
+    uint32_t since_us = 0; // First sample of the current run
+    float lowest = 0, highest = 0; // Over the ripple block
+    bool settling = false; // Ripple block follows a setpoint change; not checked
+    float tripValue = 0;
+    uint32_t trips = 0;
+  };
+
+  void latch(uint8_t i, float value) {
+    latched |= 1u << i;
+    if (rules[i].safeOutput) holdSafe = true;
+    states[i].tripValue = value;
+    states[i].trips++;
+  }
+
+  const AlarmRule *rules = nullptr;
+  uint8_t count = 0;
+  RuleState states[ALARM_MAX_RULES];
+  uint32_t latched = 0;
+  bool holdSafe = false;
+  float lastSetpoint_mA = NAN;
+};
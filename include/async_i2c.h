@@ -0,0 +1,101 @@
+#pragma once
+
+// async_i2c.h
+//
+// Non-blocking register reads for the ESP32. startRead() queues a request
+// and returns at once; a worker task runs the Wire transaction, calls the
+// request's callback if it has one and marks the request done. Meanwhile
+// the caller keeps filtering, publishing telemetry and serving the web.
+//
+// A request object must stay alive and must not be restarted until its
+// status is no longer ASYNC_I2C_PENDING. The callback runs in the worker
+// task just before the status changes, so it should only record the result.
+
+#ifndef ESP8266
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <atomic>
+#include "i2c_bus.h"
+
+#define ASYNC_I2C_QUEUE_DEPTH 4
+
+enum AsyncI2cStatus : uint8_t {
+  ASYNC_I2C_IDLE,
+  ASYNC_I2C_PENDING,
+  ASYNC_I2C_DONE,
+  ASYNC_I2C_ERROR,
+};
+
+struct AsyncI2cRead;
+typedef void (*AsyncI2cCallback)(AsyncI2cRead &request);
+
+struct AsyncI2cRead {
+  uint8_t address;
+  uint8_t reg;
+  AsyncI2cCallback callback = nullptr; // Optional, runs in the worker task
+  void *context = nullptr;             // For the callback
+  uint16_t value = 0;                  // Valid once status is ASYNC_I2C_DONE
+  uint8_t error = 0;                   // Wire error code on ASYNC_I2C_ERROR
+  std::atomic<uint8_t> status{ASYNC_I2C_IDLE};
+
+  AsyncI2cRead(uint8_t address, uint8_t reg) : address(address), reg(reg) {}
+
+  bool isPending() const { return status.load(std::memory_order_acquire) == ASYNC_I2C_PENDING; }
+};
+
+class AsyncI2c {
+public:
+  // Starts the worker task. Wire transactions from other tasks remain
+  // possible; Wire serialises them against the worker.
+  bool begin(TwoWire &wire, UBaseType_t priority, BaseType_t core) {
+    this->wire = &wire;
+    queue = xQueueCreate(ASYNC_I2C_QUEUE_DEPTH, sizeof(AsyncI2cRead *));
+    if (queue == nullptr) return false;
+    return xTaskCreatePinnedToCore(worker, "async_i2c", 3072, this, priority, nullptr, core) == pdPASS;
+  }
+
+  // Queues a read. Returns false, leaving the request untouched, if it is
+  // still pending or the queue is full.
+  bool startRead(AsyncI2cRead &request) {
+    if (request.isPending()) return false;
+    request.status.store(ASYNC_I2C_PENDING, std::memory_order_release);
+    AsyncI2cRead *pointer = &request;
+    if (xQueueSend(queue, &pointer, 0) != pdTRUE) {
+      request.status.store(ASYNC_I2C_IDLE, std::memory_order_release);
+      rejected++;
+      return false;
+    }
+    return true;
+  }
+
+  uint32_t getCompleted() const { return completed; }
+  uint32_t getErrors() const { return errors; }
+  uint32_t getRejected() const { return rejected; }
+
+private:
+  static void worker(void *arg) {
+    AsyncI2c *self = static_cast<AsyncI2c *>(arg);
+    AsyncI2cRead *request;
+    for (;;) {
+      if (xQueueReceive(self->queue, &request, portMAX_DELAY) != pdTRUE) continue;
+      uint16_t value = 0;
+      uint8_t error = i2cReadRegister16(*self->wire, request->address, request->reg, value);
+      request->value = value;
+      request->error = error;
+      if (error == 0) self->completed++; else self->errors++;
+      // The callback runs before the request is released, so the owner
+      // cannot restart it underneath the callback.
+      if (request->callback != nullptr) request->callback(*request);
+      request->status.store(error == 0 ? ASYNC_I2C_DONE : ASYNC_I2C_ERROR, std::memory_order_release);
+    }
+  }
+
+  TwoWire *wire = nullptr;
+  QueueHandle_t queue = nullptr;
+  volatile uint32_t completed = 0;
+  volatile uint32_t errors = 0;
+  volatile uint32_t rejected = 0;
+};
+
+#endif
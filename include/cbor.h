@@ -0,0 +1,79 @@
+#pragma once
+
+// cbor.h
+//
+// Minimal fixed-buffer CBOR (RFC 8949) encoder covering the handful of
+// types the firmware emits: maps, text strings, unsigned integers and
+// single-precision floats. Writes past the end of the buffer are dropped
+// and flagged through overflow().
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class CborWriter {
+public:
+  CborWriter(uint8_t *buf, size_t capacity) : buf(buf), capacity(capacity) {}
+
+  void map(size_t pairs) { head(5, pairs); }
+  void array(size_t items) { head(4, items); }
+  void uint(uint32_t value) { head(0, value); }
+
+  void text(const char *str) {
+    size_t len = strlen(str);
+    head(3, len);
+    bytes((const uint8_t *)str, len);
+  }
+
+  void float32(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(0xFA);
+    put((uint8_t)(bits >> 24));
+    put((uint8_t)(bits >> 16));
+    put((uint8_t)(bits >> 8));
+    put((uint8_t)bits);
+  }
+
+  // Convenience for map entries.
+  void entry(const char *key, float value) { text(key); float32(value); }
+  void entry(const char *key, uint32_t value) { text(key); uint(value); }
+
+  size_t size() const { return length; }
+  bool overflow() const { return overflowed; }
+
+private:
+  void head(uint8_t major, uint32_t value) {
+    uint8_t mt = (uint8_t)(major << 5);
+    if (value < 24) {
+      put(mt | (uint8_t)value);
+    } else if (value <= 0xFF) {
+      put(mt | 24);
+      put((uint8_t)value);
+    } else if (value <= 0xFFFF) {
+      put(mt | 25);
+      put((uint8_t)(value >> 8));
+      put((uint8_t)value);
+    } else {
+      put(mt | 26);
+      put((uint8_t)(value >> 24));
+      put((uint8_t)(value >> 16));
+      put((uint8_t)(value >> 8));
+      put((uint8_t)value);
+    }
+  }
+
+  void put(uint8_t b) {
+    if (length < capacity) buf[length++] = b;
+    else overflowed = true;
+  }
+
+  void bytes(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) put(data[i]);
+  }
+
+  uint8_t *buf;
+  size_t capacity;
+  size_t length = 0;
+  bool overflowed = false;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+// client_aggregates.h
+//
+// Per-client decimation for /data. Every fresh control sample (one with a
+// new current reading) is folded into a running min/max/mean for each
+// client that has polled recently, and a request returns (and restarts)
+// the aggregate covering the samples since that client's previous request.
+// A client polling once per second thereby still sees transients that
+// lasted a single control period. The voltage is aggregated alongside at
+// whatever value it held for that sample, since it is read less often.
+
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AGG_MAX_CLIENTS 8
+#define AGG_CLIENT_TIMEOUT_MS 10000 // Slots idle this long stop aggregating
+
+struct RunningStats {
+  uint32_t count;
+  float min;
+  float max;
+  double sum;
+
+  void reset() {
+    count = 0;
+    min = FLT_MAX;
+    max = -FLT_MAX;
+    sum = 0;
+  }
+
+  void add(float value) {
+    count++;
+    if (value < min) min = value;
+    if (value > max) max = value;
+    sum += value;
+  }
+
+  float mean() const { return count ? (float)(sum / count) : 0.0f; }
+};
+
+struct ClientAggregate {
+  RunningStats current_mA;
+  RunningStats voltage_V;
+};
+
+class ClientAggregator {
+public:
+  // Folds one control sample into every active client. Bounded by
+  // AGG_MAX_CLIENTS regardless of how many clients have come and gone.
+  void add(float current_mA, float voltage_V) {
+    for (uint8_t i = 0; i < AGG_MAX_CLIENTS; i++) {
+      if (!slots[i].active) continue;
+      slots[i].aggregate.current_mA.add(current_mA);
+      slots[i].aggregate.voltage_V.add(voltage_V);
+    }
+  }
+
+  // Returns the aggregate accumulated since the previous call for id and
+  // starts a new interval. A client seen for the first time gets an empty
+  // aggregate (count 0). The least recently seen slot is recycled when the
+  // table is full.
+  ClientAggregate take(uint32_t id, uint32_t now_ms) {
+    expire(now_ms);
+    Slot *slot = find(id);
+    ClientAggregate result;
+    if (slot == nullptr) {
+      slot = allocate(id);
+      slot->aggregate.current_mA.reset();
+      slot->aggregate.voltage_V.reset();
+    }
+    result = slot->aggregate;
+    slot->aggregate.current_mA.reset();
+    slot->aggregate.voltage_V.reset();
+    slot->lastSeen_ms = now_ms;
+    return result;
+  }
+
+  uint8_t activeClients() const {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < AGG_MAX_CLIENTS; i++) n += slots[i].active;
+    return n;
+  }
+
+private:
+  struct Slot {
+    bool active;
+    uint32_t id;
+    uint32_t lastSeen_ms;
+    ClientAggregate aggregate;
+  };
+
+  void expire(uint32_t now_ms) {
+    for (uint8_t i = 0; i < AGG_MAX_CLIENTS; i++) {
+      if (slots[i].active && now_ms - slots[i].lastSeen_ms > AGG_CLIENT_TIMEOUT_MS) slots[i].active = false;
+    }
+  }
+
+  Slot *find(uint32_t id) {
+    for (uint8_t i = 0; i < AGG_MAX_CLIENTS; i++) {
+      if (slots[i].active && slots[i].id == id) return &slots[i];
+    }
+    return nullptr;
+  }
+
+  Slot *allocate(uint32_t id) {
+    Slot *victim = &slots[0];
+    for (uint8_t i = 0; i < AGG_MAX_CLIENTS; i++) {
+      if (!slots[i].active) {
+        victim = &slots[i];
+        break;
+      }
+      if (slots[i].lastSeen_ms < victim->lastSeen_ms) victim = &slots[i];
+    }
+    victim->active = true;
+    victim->id = id;
+    return victim;
+  }
+
+  Slot slots[AGG_MAX_CLIENTS] = {};
+};
+
+// FNV-1a, used to turn a client-supplied id string into a slot key.
+inline uint32_t fnv1a(const char *str, uint32_t hash = 2166136261u) {
+  while (*str) {
+    hash ^= (uint8_t)*str++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+// command_queue.h
+//
+// Bounded lock-free multi-producer / single-consumer queue (Vyukov's
+// per-cell sequence scheme) used to hand state-changing requests from the
+// HTTP and SCPI front ends to the control step, plus a small recorder for
+// the time those requests spend between arrival and actuation.
+//
+// The control step drains the whole queue on every tick, whatever else it
+// is doing. A command left queued during a safety hold could otherwise
+// never run, and the hold may be waiting for exactly that command (a fault
+// or alarm clear).
+
+#include <atomic>
+#include <stdint.h>
+
+#ifdef ESP8266
+  #include <Arduino.h>
+#endif
+
+// Compare-and-swap on a 32-bit atomic. The ESP8266 has a single core and no
+// atomic read-modify-write instructions, so there the CAS is made atomic by
+// masking interrupts for its few instructions.
+inline bool atomicCas32(std::atomic<uint32_t> &target, uint32_t &expected, uint32_t desired) {
+#ifdef ESP8266
+  uint32_t savedPs = xt_rsil(15);
+  uint32_t current = target.load(std::memory_order_relaxed);
+  bool swapped = current == expected;
+  if (swapped) target.store(desired, std::memory_order_relaxed);
+  else expected = current;
+  xt_wsr_ps(savedPs);
+  return swapped;
+#else
+  return target.compare_exchange_weak(expected, desired, std::memory_order_relaxed);
+#endif
+}
+
+// Capacity must be a power of two.
+template <typename T, uint32_t Capacity>
+class MpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  MpscQueue() {
+    for (uint32_t i = 0; i < Capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // Safe from any number of producers. Returns false when full.
+  bool push(const T &item) {
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = cells[pos & (Capacity - 1)];
+      uint32_t seq = cell.sequence.load(std::memory_order_acquire);
+      int32_t diff = (int32_t)(seq - pos);
+      if (diff == 0) {
+        if (atomicCas32(enqueuePos, pos, pos + 1)) {
+          cell.item = item;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Single consumer only. Returns false when empty.
+  bool pop(T &item) {
+    Cell &cell = cells[dequeuePos & (Capacity - 1)];
+    uint32_t seq = cell.sequence.load(std::memory_order_acquire);
+    if ((int32_t)(seq - (dequeuePos + 1)) < 0) return false;
+    item = cell.item;
+    cell.sequence.store(dequeuePos + Capacity, std::memory_order_release);
+    dequeuePos++;
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<uint32_t> sequence;
+    T item;
+  };
+
+  Cell cells[Capacity];
+  std::atomic<uint32_t> enqueuePos{0};
+  uint32_t dequeuePos = 0;
+};
+
+#define LATENCY_WINDOW 64 // Most recent latencies kept for percentiles
+
+struct LatencyStats {
+  uint32_t count; // Total recorded since boot
+  uint32_t p50_us;
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t max_us; // Worst since boot
+};
+
+// Ring of recent latencies. Recording is O(1); percentiles are computed on
+// demand from a sorted copy of the window.
+class LatencyRecorder {
+public:
+  void record(uint32_t latency_us) {
+    window[total % LATENCY_WINDOW] = latency_us;
+    total++;
+    if (latency_us > worst) worst = latency_us;
+  }
+
+  LatencyStats stats() const {
+    LatencyStats result = {total, 0, 0, 0, worst};
+    uint32_t n = total < LATENCY_WINDOW ? total : LATENCY_WINDOW;
+    if (n == 0) return result;
+
+    uint32_t sorted[LATENCY_WINDOW];
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t value = window[i];
+      uint32_t j = i;
+      while (j > 0 && sorted[j - 1] > value) {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = value;
+    }
+    result.p50_us = sorted[(n - 1) * 50 / 100];
+    result.p90_us = sorted[(n - 1) * 90 / 100];
+    result.p99_us = sorted[(n - 1) * 99 / 100];
+    return result;
+  }
+
+private:
+  uint32_t window[LATENCY_WINDOW];
+  uint32_t total = 0;
+  uint32_t worst = 0;
+};
+
+// Arrival stamps of commands that have been applied but not yet acted on
+// by an output write. actuated() records their latency. A stamp that does
+// not fit is recorded at the tick that applied it instead, so the tracker
+// never limits how many commands a tick can take.
+template <uint8_t Capacity>
+class ActuationLatency {
+public:
+  void applied(uint32_t arrival_us, uint32_t now_us) {
+    if (count < Capacity) arrivals[count++] = arrival_us;
+    else recorder.record(now_us - arrival_us);
+  }
+
+  void actuated(uint32_t now_us) {
+    for (uint8_t i = 0; i < count; i++) recorder.record(now_us - arrivals[i]);
+    count = 0;
+  }
+
+  uint8_t pending() const { return count; }
+  LatencyStats stats() const { return recorder.stats(); }
+
+private:
+  LatencyRecorder recorder;
+  uint32_t arrivals[Capacity];
+  uint8_t count = 0;
+};
+
+// Pops every queued command into apply() and notes its arrival_us with
+// latency. Returns the number of commands applied.
+template <typename T, uint32_t QueueCapacity, uint8_t PendingCapacity, typename Apply>
+uint32_t drainCommands(MpscQueue<T, QueueCapacity> &queue, ActuationLatency<PendingCapacity> &latency, uint32_t now_us,
+                       Apply apply) {
+  T command;
+  uint32_t applied = 0;
+  while (queue.pop(command)) {
+    apply(command);
+    latency.applied(command.arrival_us, now_us);
+    applied++;
+  }
+  return applied;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+// compliance_guard.h
+//
+// Predictive compliance-limit guard. Fits dV/dt over the last few bus
+// voltage readings and extrapolates to a horizon a few control periods
+// ahead. If the limit would be reached within that horizon, the controller
+// is told to stop driving the output further, before the hard check at the
+// limit itself has to step in. With an open circuit the voltage ramps fast
+// enough that waiting for the reading at the limit overshoots it.
+
+#include <stdint.h>
+
+#define COMPLIANCE_GUARD_WINDOW 4
+
+class ComplianceGuard {
+public:
+  void begin(float limit_V, uint32_t horizon_us) {
+    this->limit_V = limit_V;
+    this->horizon_us = horizon_us;
+    count = 0;
+    head = 0;
+  }
+
+  // Adds a fresh bus voltage reading taken at time_us.
+  void addVoltage(uint32_t time_us, float voltage_V) {
+    times[head] = time_us;
+    volts[head] = voltage_V;
+    head = (head + 1) % COMPLIANCE_GUARD_WINDOW;
+    if (count < COMPLIANCE_GUARD_WINDOW) count++;
+    slope_VPerUs = fitSlope();
+  }
+
+  // Voltage expected at now_us + horizon, extrapolated from the newest
+  // reading along the fitted slope. Falling voltages are not extrapolated.
+  float predict(uint32_t now_us) const {
+    if (count == 0) return 0;
+    uint8_t newest = (head + COMPLIANCE_GUARD_WINDOW - 1) % COMPLIANCE_GUARD_WINDOW;
+    float ahead_us = (float)(now_us - times[newest]) + horizon_us;
+    return volts[newest] + (slope_VPerUs > 0 ? slope_VPerUs * ahead_us : 0);
+  }
+
+  bool breachPredicted(uint32_t now_us) const { return predict(now_us) >= limit_V; }
+
+  float getSlope_VPerS() const { return slope_VPerUs * 1e6f; }
+
+private:
+  // Least-squares slope over the window, with times taken relative to the
+  // oldest reading so the float arithmetic keeps its precision.
+  float fitSlope() const {
+    if (count < 2) return 0;
+    uint8_t oldest = (head + COMPLIANCE_GUARD_WINDOW - count) % COMPLIANCE_GUARD_WINDOW;
+    float sumT = 0, sumV = 0, sumTT = 0, sumTV = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t index = (oldest + i) % COMPLIANCE_GUARD_WINDOW;
+      float t = (float)(times[index] - times[oldest]);
+      sumT += t;
+      sumV += volts[index];
+      sumTT += t * t;
+      sumTV += t * volts[index];
+    }
+    float denominator = count * sumTT - sumT * sumT;
+    if (denominator <= 0) return 0;
+    return (count * sumTV - sumT * sumV) / denominator;
+  }
+
+  float limit_V = 0;
+  uint32_t horizon_us = 0;
+  uint32_t times[COMPLIANCE_GUARD_WINDOW];
+  float volts[COMPLIANCE_GUARD_WINDOW];
+  uint8_t count = 0;
+  uint8_t head = 0;
+  float slope_VPerUs = 0;
+};
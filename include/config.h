@@ -3,15 +3,138 @@
 // --- Pin Definitions ---
 #define DAC_PIN 25
 
+// --- Serial / SCPI Interface ---
+#define SERIAL_BAUD 921600
+#define SERIAL_TX_BUFFER_SIZE 2048 // ESP32 only; holds ~70 telemetry frames
+#define SERIAL_STREAM_ON_BOOT false // Binary telemetry stream (SYST:STR ON|OFF)
+#define SCPI_TCP_PORT 5025 // Standard raw-socket SCPI port
+#define SCPI_POLL_BYTES 64 // Max bytes consumed per stream per loop() pass
+
+// --- UDP Multicast Telemetry ---
+#define UDP_STREAM_ON_BOOT false // Toggle at runtime with SYST:UDP ON|OFF
+#define UDP_STREAM_GROUP 239, 255, 50, 25 // Multicast group
+#define UDP_STREAM_PORT 5026
+#define UDP_STREAM_DECIMATION 1 // Send every Nth control sample
+#define UDP_STREAM_BATCH 16 // Samples per datagram
+
+// --- /data Long-Poll ---
+#define LONGPOLL_MAX_WAIT_MS 10000 // Upper bound on /data?wait=
+#define LONGPOLL_DEADBAND_MA 0.5 // Current change that counts as an update
+#define LONGPOLL_DEADBAND_V 0.05 // Voltage change that counts as an update
+
 // --- INA219 Sensor Configuration ---
 #define INA219_ADDRESS 0x40
 #define SHUNT_RESISTOR_OHMS 0.1 // 100 mOhm shunt resistor
 #define MAXIMUM_BUS_VOLTAGE_INA219 25.0 // Safety limit for INA219
+#define INA219_I2C_CLOCK_HZ 400000 // Wire clock (fast mode)
+#define INA219_SHUNT_ADC 0x03 // 12-bit, 532 us conversion
+#define INA219_BUS_ADC 0x01 // 10-bit, 148 us: keeps the shunt/bus cycle short
+
+// --- I2C Fault Recovery (see ina219_link.h) ---
+// Upper bound on one Wire transaction. On the ESP32 the driver waits this
+// many 1 ms FreeRTOS ticks, and a one-tick wait can expire almost at once
+// because it ends at the next tick boundary. With the control step locked
+// to the tick, a read near a boundary would keep timing out, so use at
+// least 2. The ESP8266's clock-stretch limit is a busy-wait in
+// microseconds and is exact.
+#ifdef ESP8266
+  #define I2C_TIMEOUT_MS 1
+#else
+  #define I2C_TIMEOUT_MS 2
+#endif
+#define I2C_FAULT_THRESHOLD 3 // Consecutive failed reads before the sensor counts as lost
+#define I2C_RETRY_MIN_MS 10 // First recovery attempt; the delay doubles per failure
+#define I2C_RETRY_MAX_MS 2000
+#define I2C_FAULT_INJECTION 0 // SYSTem:I2C:INJect <n> fails the next n reads
+
+// --- Multi-Rate Sensing (see sensor_schedule.h) ---
+#define CONTROL_VOLTAGE_DECIMATION 8 // Bus voltage read every Nth tick
+#define COMPLIANCE_GUARD_MARGIN_V 2.0 // Read voltage every tick when a rise could come this close to the limit
+
+// --- Scheduling ---
+#define CONTROL_PERIOD_US 2000 // Control step period; whole ms unless FAST_CONTROL (PID sample time)
+#define CONTROL_LATE_TOLERANCE_US 200 // Start jitter that is not counted as late
+#define WEB_BUDGET_US 1000 // Web/SCPI time allowed per control period
+#define WEB_CHUNK_BYTES 1024 // Page is sent in chunks of this size
+
+// --- Control Watchdog (see control_watchdog.h) ---
+#define CONTROL_WATCHDOG 1 // Force the safe output if the control step stalls
+#define WATCHDOG_STALL_US 50000 // Silence that trips the watchdog
+#define WATCHDOG_CHECK_US 5000 // How often the supervisor looks
+#define WATCHDOG_DEADLINE_US (2 * CONTROL_PERIOD_US) // Longer gaps count as deadline misses
+#ifdef ESP8266
+  #define WATCHDOG_SAFE_CODE 0 // The trip drives the pin low, see control_watchdog.h
+#else
+  #define WATCHDOG_SAFE_CODE DAC_SAFETY_VALUE
+#endif
+
+// --- Fast Control Path (see fast_control.h) ---
+// ESP8266: run the control step from a timer interrupt. Avoid flash writes
+// (e.g. saving WiFi credentials) while it runs: the ISR calls analogWrite(),
+// which is not in IRAM.
+#define CONTROL_TIMER_ISR 0
+// ESP32: read the INA219 from a task on core 0, pipelined with the control
+// step on core 1. CONTROL_PERIOD_US can then be lowered to the I2C time.
+#define CONTROL_DUAL_CORE 0
+// ESP32: start INA219 reads from the control step without waiting for them;
+// an I2C worker task on core 0 completes them.
+#define CONTROL_ASYNC_I2C 0
+#define ACQUISITION_TASK_PRIORITY 5 // Acquisition / I2C worker task
+#define SOFT_I2C_CLOCK_HZ 400000 // Bit-banged I2C clock
+#define SOFT_I2C_PHASE_US 10 // ESP8266 timer ISR: spacing of the interrupts that clock out each bus bit
+#define I2C_SDA_PIN SDA // Wire default pins (GPIO4/5 on ESP8266, 21/22 on ESP32)
+#define I2C_SCL_PIN SCL
+
+// --- Compliance Override ---
+#define RECOVERY_BAND_MA 2.0 // Back in regulation once this close to the setpoint
+#define COMPLIANCE_PREDICT_PERIODS 4 // Cap the output if the limit is predicted within this many periods
+
+// --- Load Fault Detection (see load_faults.h) ---
+#define LOAD_FAULT_ACTION LOAD_FAULT_ACTION_SAFE_OUTPUT // Or _REPORT, _MIN_OUTPUT
+#define LOAD_FAULT_CONFIRM_TICKS 2 // Consecutive ticks before a fault latches
+#define OPEN_CIRCUIT_OUTPUT_CODE 250 // Output code that counts as saturated
+#define OPEN_CIRCUIT_CURRENT_MA 1.0
+#define OPEN_CIRCUIT_VOLTAGE_V 20.0
+#define SHORT_CIRCUIT_CURRENT_MA 5.0
+#define SHORT_CIRCUIT_VOLTAGE_V 0.05
+
+// --- Alarms (see alarms.h) ---
+// {quantity, condition, threshold, samples, hold_ms, safe output}. At most
+// ALARM_MAX_RULES rules; samples are control ticks (CONTROL_PERIOD_US).
+#define ALARM_RULES \
+  {ALARM_VOLTAGE, ALARM_ABOVE, 24.0, 50, 0, false}, /* Near compliance for 100 ms */ \
+  {ALARM_SETPOINT_ERROR, ALARM_ABOVE, 10.0, 1, 2000, false}, /* Out of regulation for 2 s */ \
+  {ALARM_CURRENT_RIPPLE, ALARM_ABOVE, 5.0, 250, 0, false}, /* Oscillation, per 0.5 s block */ \
+  {ALARM_CURRENT_OF_LIMIT, ALARM_ABOVE, 110.0, 5, 0, true}, /* Overcurrent, 10% past the active limit */
+#define ALARM_GPIO_PIN -1 // Driven high while any alarm is latched; -1 for none
+
+// --- Event Log (see event_log.h) ---
+#define EVENT_LOG_CAPACITY 64 // Events kept; must be a power of two
+#define EVENT_I2C_INTERVAL_MS 1000 // At most one I2C error event per interval
+
+// --- Flight Recorder (see flight_recorder.h) ---
+#define FLIGHT_RECORDER 1 // Keep recent samples and events across resets
+#ifdef ESP8266
+  #define FLIGHT_RECORDER_SAMPLES 16 // RTC user memory only has room for a few
+  #define FLIGHT_RECORDER_EVENTS 4
+#else
+  #define FLIGHT_RECORDER_SAMPLES 256 // About half a second at CONTROL_PERIOD_US
+  #define FLIGHT_RECORDER_EVENTS 32
+#endif
+
+// --- Default Control Parameters ---
+#define DEFAULT_TARGET_CURRENT_MA 100.0
+#define DEFAULT_MAX_CURRENT_MA 500.0
+#define COMMAND_QUEUE_DEPTH 16 // Pending HTTP/SCPI commands (power of two)
 
 // --- Default PID Tuning Parameters ---
+// Per second, applied every control step. Kd acts on the tick-to-tick
+// change in measured current, so at CONTROL_PERIOD_US it also amplifies
+// INA219 noise; lower it if the output chatters.
 #define DEFAULT_KP 20.0
 #define DEFAULT_KI 5.0
 #define DEFAULT_KD 1.0
+#define CONTROL_FLOAT_PID 0 // Use FloatPID (single precision) instead of BasicPID<double>
 
 // --- Buck Converter Parameters ---
 #define BUCK_FEEDBACK_VOLTAGE 1.25 // Feedback voltage for the buck converter
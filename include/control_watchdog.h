@@ -0,0 +1,127 @@
+#pragma once
+
+// control_watchdog.h
+//
+// Supervises the control step from a context that keeps running when
+// loop() does not: a hung handleClient(), a Wire transaction that never
+// completes. The step feeds the watchdog each time it runs; a periodic
+// check forces the output to a safe code once the step has been silent
+// for longer than the stall window, and the step picks the trip up when
+// it runs again.
+//
+//   ESP8266: timer0 interrupt. Not available with CONTROL_TIMER_ISR, which
+//            owns timer0 and runs the control step from it anyway.
+//   ESP32:   esp_timer callback, dispatched from the high-priority esp_timer
+//            task on core 0 while loop() runs on core 1.
+//
+// The trip has to work while flash is unavailable, because a stall is most
+// likely while loop() sits in a flash operation. On the ESP32 the DAC
+// register write is IRAM-only. The ESP8266's analogWrite() is in flash, so
+// there the trip uses digitalWrite() instead, which is in IRAM and stops the
+// PWM waveform before driving the pin: the pin goes low, output code 0,
+// below anything the PID writes. Pass 0 as the safe code there, so the step
+// resyncs to what the pin really holds.
+//
+// The gaps between feeds also give deadline-miss counts and the longest
+// stall, whether or not the watchdog tripped.
+
+#include <Arduino.h>
+#include "fast_control.h"
+
+#ifndef ESP8266
+  #include <esp_timer.h>
+#endif
+
+class ControlWatchdog {
+public:
+  // Gaps longer than deadline_us count as misses; stall_us of silence
+  // forces safeCode. The check runs every check_us.
+  bool begin(uint32_t stall_us, uint32_t deadline_us, uint32_t check_us, uint8_t safeCode) {
+    this->stall_us = stall_us;
+    this->deadline_us = deadline_us;
+    this->safeCode = safeCode;
+    lastFeed_us = micros();
+    #ifdef ESP8266
+      instance = this;
+      checkCycles = ESP.getCpuFreqMHz() * check_us;
+      timer0_isr_init();
+      timer0_attachInterrupt(onTimer);
+      timer0_write(ESP.getCycleCount() + checkCycles);
+      return true;
+    #else
+      esp_timer_create_args_t args = {};
+      args.callback = onTimer;
+      args.arg = this;
+      args.dispatch_method = ESP_TIMER_TASK;
+      args.name = "control_watchdog";
+      esp_timer_handle_t timer;
+      return esp_timer_create(&args, &timer) == ESP_OK && esp_timer_start_periodic(timer, check_us) == ESP_OK;
+    #endif
+  }
+
+  // Called by the control step each time it runs. Returns the time since
+  // the previous feed.
+  uint32_t feed(uint32_t now_us) {
+    uint32_t gap = now_us - lastFeed_us;
+    lastFeed_us = now_us;
+    if (gap > deadline_us) deadlineMisses++;
+    if (gap > longestGap_us) longestGap_us = gap;
+    return gap;
+  }
+
+  // True once for each time the watchdog forced the safe output. The
+  // output stage and PID no longer match the pin until they resync.
+  bool takeTrip() {
+    if (!tripped) return false;
+    tripped = false;
+    return true;
+  }
+
+  uint8_t getSafeCode() const { return safeCode; }
+  uint32_t getTrips() const { return trips; }
+  uint32_t getDeadlineMisses() const { return deadlineMisses; }
+  uint32_t getLongestGap_us() const { return longestGap_us; }
+
+private:
+  void IRAM_ATTR check() {
+    if (tripped) return; // Already safe; waiting for the step to return
+    // lastFeed_us before micros(): on the ESP32 feed() runs on the other
+    // core, and a feed landing between the two reads would make the
+    // unsigned gap wrap to about 4e9 and trip during normal regulation.
+    // The signed compare also treats a feed stamp ahead of now as no gap.
+    uint32_t lastFeed = lastFeed_us;
+    if ((int32_t)((uint32_t)micros() - lastFeed) < (int32_t)stall_us) return;
+    #ifdef ESP8266
+      digitalWrite(DAC_PIN, LOW);
+    #else
+      fastControlWriteOutput(safeCode);
+    #endif
+    trips++;
+    tripped = true;
+  }
+
+  #ifdef ESP8266
+    static void IRAM_ATTR onTimer() {
+      timer0_write(ESP.getCycleCount() + instance->checkCycles);
+      instance->check();
+    }
+
+    static ControlWatchdog *instance;
+    uint32_t checkCycles = 0;
+  #else
+    static void onTimer(void *arg) { static_cast<ControlWatchdog *>(arg)->check(); }
+  #endif
+
+  uint32_t stall_us = 0;
+  uint32_t deadline_us = 0;
+  uint8_t safeCode = 0;
+  volatile uint32_t lastFeed_us = 0;
+  volatile bool tripped = false;
+  volatile uint32_t trips = 0;
+  uint32_t deadlineMisses = 0;
+  uint32_t longestGap_us = 0;
+};
+
+#ifdef ESP8266
+ControlWatchdog *ControlWatchdog::instance = nullptr;
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+// delta_publisher.h
+//
+// Deadband-filtered view of the live data used by the /data long-poll.
+// A field is only republished when it moves further than its deadband from
+// the value last published, so a client that holds the published state at
+// sequence N can be brought up to date by sending just the fields changed
+// since N. The changed-field masks of the most recent publications are kept
+// in a small ring; clients further behind get a full update.
+
+#include <math.h>
+#include <stdint.h>
+
+enum DeltaField {
+  DELTA_VOLTAGE,
+  DELTA_CURRENT,
+  DELTA_SETPOINT,
+  DELTA_KP,
+  DELTA_KI,
+  DELTA_KD,
+  DELTA_MAX_LIMIT,
+  DELTA_FLAGS,
+  DELTA_FIELD_COUNT
+};
+
+#define DELTA_ALL_FIELDS ((uint16_t)((1u << DELTA_FIELD_COUNT) - 1))
+#define DELTA_HISTORY 32 // Publications remembered for delta replies
+
+class DeltaPublisher {
+public:
+  // Deadbands for the measured fields; every other field republishes on
+  // any change.
+  void setDeadbands(float current_mA, float voltage_V) {
+    deadband[DELTA_CURRENT] = current_mA;
+    deadband[DELTA_VOLTAGE] = voltage_V;
+  }
+
+  float getDeadband(DeltaField field) const { return deadband[field]; }
+
+  // Called once per control sample with the latest value of every field.
+  void update(const float values[DELTA_FIELD_COUNT]) {
+    uint16_t mask = 0;
+    for (uint8_t i = 0; i < DELTA_FIELD_COUNT; i++) {
+      if (!initialised || fabsf(values[i] - published[i]) > deadband[i]) {
+        published[i] = values[i];
+        mask |= (uint16_t)(1u << i);
+      }
+    }
+    initialised = true;
+    if (mask == 0) return;
+    seq++;
+    masks[seq % DELTA_HISTORY] = mask;
+  }
+
+  uint32_t getSeq() const { return seq; }
+  float value(uint8_t field) const { return published[field]; }
+
+  // Fields a client holding publication clientSeq is missing. Returns
+  // DELTA_ALL_FIELDS if clientSeq is unknown (too old, or from a previous
+  // boot) and 0 if the client is current.
+  uint16_t changedSince(uint32_t clientSeq) const {
+    if (clientSeq == seq) return 0;
+    if (clientSeq == 0 || clientSeq > seq || seq - clientSeq >= DELTA_HISTORY) return DELTA_ALL_FIELDS;
+    uint16_t mask = 0;
+    for (uint32_t s = clientSeq + 1; s <= seq; s++) mask |= masks[s % DELTA_HISTORY];
+    return mask;
+  }
+
+private:
+  float published[DELTA_FIELD_COUNT] = {};
+  float deadband[DELTA_FIELD_COUNT] = {};
+  uint16_t masks[DELTA_HISTORY] = {};
+  uint32_t seq = 0;
+  bool initialised = false;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+// event_log.h
+//
+// Fixed-size ring of timestamped events: setpoint changes, PID retunes,
+// calibration changes, safety trips, load faults, alarms, watchdog trips,
+// sensor loss and recovery, WiFi drops and I2C errors. Appending is O(1)
+// and never allocates, so the control step can log directly; once the ring
+// is full the oldest events are overwritten.
+//
+// Every event gets a sequence number one higher than the previous, so a
+// client that remembers the last number it saw can ask for the rest
+// (/events?since=<seq>) and can tell from oldestSeq() whether it missed
+// any. The log is written and read from the loop task only, so it needs
+// no locking.
+//
+// EventRecord is also the binary wire format of /events. This header has
+// no Arduino dependencies.
+
+#include <stdint.h>
+
+enum EventType : uint8_t {
+  EVENT_BOOT,             // value: limit mA, setpoint mA
+  EVENT_SETPOINT,         // value: new mA, previous mA
+  EVENT_PID_TUNING,       // value: Kp, Ki, Kd
+  EVENT_CALIBRATION,      // value: current limit mA, shunt ohms
+  EVENT_SAFETY_TRIP,      // value: bus V, current mA, setpoint mA
+  EVENT_SAFETY_CLEAR,     // value: bus V, current mA, setpoint mA
+  EVENT_LOAD_FAULT,       // code: LoadFault; value: current mA, bus V
+  EVENT_LOAD_FAULT_CLEAR, // code: the LoadFault that was cleared
+  EVENT_WIFI_DOWN,        // code: wl_status_t
+  EVENT_WIFI_UP,          // value: RSSI dBm
+  EVENT_I2C_ERROR,        // value: new errors since the last event, total
+  EVENT_ALARM,            // code: rule index; value: measured, threshold
+  EVENT_ALARM_CLEAR,      // value: latched rule mask
+  EVENT_WATCHDOG_TRIP,    // value: stall ms
+  EVENT_SENSOR_LOST,      // code: last Wire error; value: total read errors
+  EVENT_SENSOR_RESTORED,  // value: recovery attempts, recoveries
+};
+
+const char *eventTypeName(uint8_t type) {
+  static const char *const names[] = {
+    "boot", "setpoint", "pid", "calibration", "safety_trip", "safety_clear",
+    "load_fault", "load_fault_clear", "wifi_down", "wifi_up", "i2c_error",
+    "alarm", "alarm_clear", "watchdog_trip",
+    "sensor_lost", "sensor_restored"};
+  return type < sizeof(names) / sizeof(names[0]) ? names[type] : "unknown";
+}
+
+struct __attribute__((packed)) EventRecord {
+  uint32_t seq;     // 1 for the first event after boot
+  uint32_t time_ms; // millis() when logged
+  uint8_t type;     // EventType
+  uint8_t code;     // Type-specific detail
+  uint16_t reserved;
+  float value[3];   // Type-specific, see EventType
+};
+
+// Capacity must be a power of two.
+template <uint32_t Capacity>
+class EventLog {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  const EventRecord &append(uint32_t time_ms, EventType type, uint8_t code = 0, float a = 0, float b = 0, float c = 0) {
+    EventRecord &record = records[latest & (Capacity - 1)];
+    record.seq = ++latest;
+    record.time_ms = time_ms;
+    record.type = type;
+    record.code = code;
+    record.reserved = 0;
+    record.value[0] = a;
+    record.value[1] = b;
+    record.value[2] = c;
+    return record;
+  }
+
+  // Sequence numbers still held run from oldestSeq() to latestSeq(); both
+  // are 0 while the log is empty.
+  uint32_t latestSeq() const { return latest; }
+  uint32_t oldestSeq() const {
+    if (latest == 0) return 0;
+    return latest > Capacity ? latest - Capacity + 1 : 1;
+  }
+
+  // Returns the event with this sequence number, or nullptr if it has been
+  // overwritten or not yet logged.
+  const EventRecord *find(uint32_t seq) const {
+    if (seq == 0 || seq > latest || seq < oldestSeq()) return nullptr;
+    return &records[(seq - 1) & (Capacity - 1)];
+  }
+
+private:
+  EventRecord records[Capacity];
+  uint32_t latest = 0;
+};
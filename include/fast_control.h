@@ -0,0 +1,543 @@
+#pragma once
+
+// fast_control.h
+//
+// ESP8266 timer-interrupt control path (CONTROL_TIMER_ISR). Sensor read,
+// safety check and PID are in IRAM and touch only DRAM, and the ticks run
+// from a hardware timer interrupt, so the period no longer depends on how
+// long loop() spends in the web server:
+//
+//   tick:    read INA219 -> safety check -> PID -> output -> sample
+//   loop():  commands -> FastControlParams (SeqLock) -> tick
+//            samples (SPSC ring) -> telemetry, /data, aggregates
+//
+// timer0 (CCOMPARE0) is used rather than timer1: from core 2.5 on, the
+// waveform generator behind analogWrite() owns timer1.
+//
+// The tick owns the I2C bus. It talks to the INA219 through a small
+// bit-banged I2C driver, because the Wire library is neither IRAM-resident
+// nor callable from an interrupt. The INA219 converts continuously and its
+// register pointer is pre-set at the end of each tick for the register the
+// next tick needs, so a normal tick is a bare 2-byte read (1 address byte,
+// 2 data bytes). The pointer only moves for the bus voltage read every
+// CONTROL_VOLTAGE_DECIMATION ticks and for calibration changes.
+//
+// A tick's transfers are queued when it starts and clocked out one bit at
+// a time. Each bit is its own timer interrupt, spaced SOFT_I2C_PHASE_US
+// apart, and the PID runs in the interrupt that completes the read. No
+// interrupt therefore spins for longer than about one SCL period plus the
+// PID, which keeps the WiFi stack's interrupt latency low.
+
+#include "config.h"
+
+#if defined(ESP8266) && CONTROL_TIMER_ISR
+  #define FAST_CONTROL 1
+#else
+  #define FAST_CONTROL 0
+#endif
+
+#include <Arduino.h>
+#ifndef ESP8266
+  #include "soc/rtc_io_reg.h"
+  #include "soc/soc.h"
+#endif
+
+// Output write that stays out of flash: the DAC register on the ESP32,
+// analogWrite() on the ESP8266 (called from IRAM, but itself in flash).
+// Outside the FAST_CONTROL block because the ESP32 control watchdog uses it.
+inline void IRAM_ATTR fastControlWriteOutput(uint8_t value) {
+  #ifdef ESP8266
+    analogWrite(DAC_PIN, value);
+  #elif DAC_PIN == 26
+    SET_PERI_REG_BITS(RTC_IO_PAD_DAC2_REG, RTC_IO_PDAC2_DAC, value, RTC_IO_PDAC2_DAC_S);
+  #else
+    SET_PERI_REG_BITS(RTC_IO_PAD_DAC1_REG, RTC_IO_PDAC1_DAC, value, RTC_IO_PDAC1_DAC_S);
+  #endif
+}
+
+#if FAST_CONTROL
+
+#include "ina219_registers.h"
+#include "seqlock.h"
+#include "telemetry_frame.h"
+
+// Open-drain lines are emulated by toggling the output enable with the
+// output latch held low.
+#define SOFT_I2C_DRIVE_LOW(mask) (GPES = (mask))
+#define SOFT_I2C_RELEASE(mask) (GPEC = (mask))
+#define SOFT_I2C_LATCH_LOW(mask) (GPOC = (mask))
+#define SOFT_I2C_INPUTS() (GPI)
+
+// Sample flag bit only produced by the fast path: the I2C read failed and
+// the output was held at the safety value.
+#define CONTROL_FLAG_I2C_ERROR 0x80
+
+// Parameters handed from loop() to the tick.
+struct FastControlParams {
+  uint32_t version;
+  float setpoint_mA;
+  float kp;
+  float ki;
+  float kd;
+  float currentLsb_mA;
+  uint16_t calibration;
+};
+
+// One control tick, handed from the tick to loop().
+struct FastControlSample {
+  uint32_t timestamp_us;
+  uint32_t paramsVersion; // FastControlParams::version in effect
+  float current_mA;
+  float voltage_V;
+  float setpoint_mA;
+  uint8_t output;
+  uint8_t flags;
+  bool currentFresh; // current_mA was read on this tick, not held
+};
+
+// Single-producer (tick) / single-consumer (loop) ring.
+template <typename T, uint8_t Capacity>
+class SpscRing {
+public:
+  bool IRAM_ATTR push(const T &item) {
+    uint8_t h = head;
+    uint8_t next = (uint8_t)((h + 1) % Capacity);
+    if (next == tail) return false;
+    items[h] = item;
+    __asm__ __volatile__("memw" ::: "memory");
+    head = next;
+    return true;
+  }
+
+  bool pop(T &item) {
+    uint8_t t = tail;
+    if (t == head) return false;
+    item = items[t];
+    __asm__ __volatile__("memw" ::: "memory");
+    tail = (uint8_t)((t + 1) % Capacity);
+    return true;
+  }
+
+private:
+  T items[Capacity];
+  volatile uint8_t head = 0;
+  volatile uint8_t tail = 0;
+};
+
+// --- Bit-banged I2C (IRAM) ---
+// Transactions are queued, then clocked out one bus bit per step(), so a
+// caller can spread a transfer over many short interrupts instead of
+// spinning through it in one. A step costs about one SCL period. A slave
+// that stretches the clock makes step() return and retry the same bit on
+// the next call rather than wait for it.
+#define SOFT_I2C_MAX_OPS 16 // Calibration write + pointer move + read
+#define SOFT_I2C_STRETCH_STEPS 20 // Steps SCL may be held low before the transfer fails
+
+class SoftI2c {
+public:
+  void begin(uint8_t sdaPin, uint8_t sclPin, uint32_t clockHz) {
+    sdaMask = 1u << sdaPin;
+    sclMask = 1u << sclPin;
+    halfPeriodCycles = ESP.getCpuFreqMHz() * 1000000u / clockHz / 2;
+    pinMode(sdaPin, INPUT_PULLUP);
+    pinMode(sclPin, INPUT_PULLUP);
+    SOFT_I2C_LATCH_LOW(sdaMask | sclMask);
+    clear();
+  }
+
+  // Empties the queue and the failure and result state for a new batch.
+  void IRAM_ATTR clear() {
+    head = count = 0;
+    bit = 0;
+    stalled = false;
+    stretchSteps = 0;
+    failedFlag = false;
+    readValue = 0;
+  }
+
+  void IRAM_ATTR queueWrite16(uint8_t address, uint8_t reg, uint16_t value) {
+    queue(OP_START);
+    queue(OP_WRITE, (uint8_t)(address << 1));
+    queue(OP_WRITE, reg);
+    queue(OP_WRITE, (uint8_t)(value >> 8));
+    queue(OP_WRITE, (uint8_t)value);
+    queue(OP_STOP);
+  }
+
+  // Moves the register pointer without reading.
+  void IRAM_ATTR queueSetPointer(uint8_t address, uint8_t reg) {
+    queue(OP_START);
+    queue(OP_WRITE, (uint8_t)(address << 1));
+    queue(OP_WRITE, reg);
+    queue(OP_STOP);
+  }
+
+  // Reads a 16-bit register at the current pointer into result().
+  void IRAM_ATTR queueRead16(uint8_t address) {
+    queue(OP_START);
+    queue(OP_WRITE, (uint8_t)(address << 1 | 1));
+    queue(OP_READ_ACK);
+    queue(OP_READ_NACK);
+    queue(OP_STOP);
+  }
+
+  // Clocks out the next bit of the queue. Returns true while work remains.
+  // A failure (bus held, NACK, stretch timeout) sends a STOP and drops the
+  // rest of the queue.
+  bool IRAM_ATTR step() {
+    if (head == count) return false;
+    Op &op = ops[head];
+    bool sample = false;
+    switch (op.kind) {
+      case OP_START:
+        if (!start()) return abort();
+        head++;
+        break;
+      case OP_STOP:
+        stop();
+        head++;
+        break;
+      default: {
+        // Eight data bits, then the acknowledge bit (bit 8).
+        bool high;
+        if (op.kind == OP_WRITE) high = bit < 8 ? (op.byte >> (7 - bit)) & 1 : true;
+        else high = bit < 8 || op.kind == OP_READ_NACK;
+        BitResult result = clockBit(high, sample);
+        if (result == BIT_STALLED) return true;
+        if (result == BIT_FAILED) return abort();
+        if (bit < 8) {
+          if (op.kind != OP_WRITE) readValue = (uint16_t)(readValue << 1 | (sample ? 1 : 0));
+          bit++;
+        } else {
+          if (op.kind == OP_WRITE && sample) return abort(); // NACK
+          sdaRelease();
+          bit = 0;
+          head++;
+        }
+        break;
+      }
+    }
+    return head != count;
+  }
+
+  bool failed() const { return failedFlag; }
+  uint16_t result() const { return readValue; }
+
+private:
+  enum OpKind : uint8_t { OP_START, OP_STOP, OP_WRITE, OP_READ_ACK, OP_READ_NACK };
+  enum BitResult : uint8_t { BIT_DONE, BIT_STALLED, BIT_FAILED };
+
+  struct Op {
+    OpKind kind;
+    uint8_t byte;
+  };
+
+  void IRAM_ATTR queue(OpKind kind, uint8_t byte = 0) {
+    if (count < SOFT_I2C_MAX_OPS) ops[count++] = {kind, byte};
+  }
+
+  inline void IRAM_ATTR wait() {
+    uint32_t start = ESP.getCycleCount();
+    while (ESP.getCycleCount() - start < halfPeriodCycles) {}
+  }
+
+  inline void IRAM_ATTR sdaLow() { SOFT_I2C_DRIVE_LOW(sdaMask); }
+  inline void IRAM_ATTR sdaRelease() { SOFT_I2C_RELEASE(sdaMask); }
+  inline void IRAM_ATTR sclLow() { SOFT_I2C_DRIVE_LOW(sclMask); }
+
+  // Releases SCL and waits at most half a period for it to rise.
+  inline bool IRAM_ATTR sclRelease() {
+    SOFT_I2C_RELEASE(sclMask);
+    uint32_t start = ESP.getCycleCount();
+    while (!(SOFT_I2C_INPUTS() & sclMask)) {
+      if (ESP.getCycleCount() - start > halfPeriodCycles) return false;
+    }
+    return true;
+  }
+
+  // One clock with SDA driven low or released; samples SDA while SCL is
+  // high. A stalled bit resumes at the SCL check on the next call.
+  BitResult IRAM_ATTR clockBit(bool high, bool &sample) {
+    if (!stalled) {
+      if (high) sdaRelease(); else sdaLow();
+      wait();
+    }
+    if (!sclRelease()) {
+      stalled = true;
+      return ++stretchSteps > SOFT_I2C_STRETCH_STEPS ? BIT_FAILED : BIT_STALLED;
+    }
+    stalled = false;
+    stretchSteps = 0;
+    sample = SOFT_I2C_INPUTS() & sdaMask;
+    wait();
+    sclLow();
+    return BIT_DONE;
+  }
+
+  bool IRAM_ATTR start() {
+    sdaRelease();
+    if (!sclRelease()) return false;
+    wait();
+    if (!(SOFT_I2C_INPUTS() & sdaMask)) return false; // Bus held by someone else
+    sdaLow();
+    wait();
+    sclLow();
+    return true;
+  }
+
+  void IRAM_ATTR stop() {
+    sdaLow();
+    wait();
+    sclRelease();
+    wait();
+    sdaRelease();
+    wait();
+  }
+
+  bool IRAM_ATTR abort() {
+    stop();
+    failedFlag = true;
+    head = count = 0;
+    bit = 0;
+    stalled = false;
+    stretchSteps = 0;
+    return false;
+  }
+
+  Op ops[SOFT_I2C_MAX_OPS];
+  uint8_t head = 0;
+  uint8_t count = 0;
+  uint8_t bit = 0;
+  bool stalled = false;
+  uint8_t stretchSteps = 0;
+  bool failedFlag = false;
+  uint16_t readValue = 0;
+  uint32_t sdaMask = 0;
+  uint32_t sclMask = 0;
+  uint32_t halfPeriodCycles = 0;
+};
+
+// --- Fast control loop ---
+class FastControlLoop {
+public:
+  // Takes over the I2C pins and starts the timer. Wire must not be used
+  // after this call. Output limits match myPID (0..255).
+  void begin(uint32_t period_us, const FastControlParams &initial) {
+    periodCycles = ESP.getCpuFreqMHz() * period_us;
+    dt_s = period_us / 1000000.0f;
+    params.write(initial);
+    i2c.begin(I2C_SDA_PIN, I2C_SCL_PIN, SOFT_I2C_CLOCK_HZ);
+    pointer = 0xFF; // Unknown; the first tick sets it
+    phaseCycles = ESP.getCpuFreqMHz() * SOFT_I2C_PHASE_US;
+    minLeadCycles = ESP.getCpuFreqMHz() * 2;
+    instance = this;
+    timer0_isr_init();
+    timer0_attachInterrupt(onTimer);
+    nextTickCycles = ESP.getCycleCount() + periodCycles;
+    timer0_write(nextTickCycles);
+  }
+
+  void setParams(const FastControlParams &next) { params.write(next); }
+  bool popSample(FastControlSample &sample) { return samples.pop(sample); }
+
+  uint32_t getI2cErrors() const { return i2cErrors; }
+  uint32_t getDroppedSamples() const { return droppedSamples; }
+  uint32_t getOverruns() const { return overruns; } // Ticks skipped because the bus was still busy
+  // Longest single timer interrupt.
+  uint32_t getMaxStep_us() const { return maxStepCycles / ESP.getCpuFreqMHz(); }
+  // Largest deviation of the tick-to-tick interval from the period.
+  uint32_t getMaxJitter_us() const { return maxJitterCycles / ESP.getCpuFreqMHz(); }
+
+private:
+  // timer0 serves both the ticks and the bus bits in between: each
+  // interrupt starts a tick if one is due, runs one bus bit, then arms the
+  // timer for the next bit or, once the bus is idle, the next tick. Ticks
+  // stay on a fixed grid, so the period does not drift.
+  static void IRAM_ATTR onTimer() {
+    FastControlLoop &self = *instance;
+    uint32_t startCycles = ESP.getCycleCount();
+    if ((int32_t)(startCycles - self.nextTickCycles) >= 0) {
+      self.nextTickCycles += self.periodCycles;
+      if (self.stage == STAGE_IDLE) self.beginTick(startCycles);
+      else self.overruns++; // Previous tick still on the bus
+    }
+    self.step();
+
+    uint32_t now = ESP.getCycleCount();
+    uint32_t target = self.nextTickCycles;
+    if (self.stage != STAGE_IDLE && (int32_t)(target - (now + self.phaseCycles)) > 0) target = now + self.phaseCycles;
+    if ((int32_t)(target - now) < (int32_t)self.minLeadCycles) target = now + self.minLeadCycles; // Never arm in the past
+    timer0_write(target);
+
+    uint32_t cycles = ESP.getCycleCount() - startCycles;
+    if (cycles > self.maxStepCycles) self.maxStepCycles = cycles;
+  }
+
+  static FastControlLoop *instance;
+
+  enum Stage : uint8_t {
+    STAGE_IDLE,       // Waiting for the next tick
+    STAGE_ACQUIRE,    // Calibration, pointer and register read on the bus
+    STAGE_PRETRIGGER, // Moving the pointer for the next tick
+  };
+
+  // Latches the parameters and queues this tick's bus transfers.
+  void IRAM_ATTR beginTick(uint32_t startCycles) {
+    if (lastStartCycles != 0) {
+      uint32_t interval = startCycles - lastStartCycles;
+      uint32_t jitter = interval > periodCycles ? interval - periodCycles : periodCycles - interval;
+      if (jitter > maxJitterCycles) maxJitterCycles = jitter;
+    }
+    lastStartCycles = startCycles;
+
+    FastControlParams p;
+    if (params.tryRead(p)) {
+      if (p.kp != active.kp || p.ki != active.ki || p.kd != active.kd) retune(p);
+      active = p;
+    }
+
+    i2c.clear();
+    writingCalibration = active.calibration != writtenCalibration;
+    if (writingCalibration) {
+      i2c.queueWrite16(INA219_ADDRESS, INA219_REG_CALIBRATION, active.calibration);
+      pointer = INA219_REG_CALIBRATION;
+    }
+    voltageTick = ++tickCount % CONTROL_VOLTAGE_DECIMATION == 0;
+    uint8_t wanted = voltageTick ? INA219_REG_BUS_VOLTAGE : INA219_REG_CURRENT;
+    if (pointer != wanted) i2c.queueSetPointer(INA219_ADDRESS, wanted);
+    pointer = wanted; // Reset to unknown if the batch fails
+    i2c.queueRead16(INA219_ADDRESS);
+    stage = STAGE_ACQUIRE;
+  }
+
+  // Runs the next bus bit; once the read is in, regulates and queues the
+  // pointer move for the next tick. Returns true while bus work remains.
+  bool IRAM_ATTR step() {
+    if (stage == STAGE_IDLE) return false;
+    if (i2c.step()) return true;
+    if (stage == STAGE_PRETRIGGER) {
+      if (i2c.failed()) pointer = 0xFF;
+      stage = STAGE_IDLE;
+      return false;
+    }
+    regulate(!i2c.failed(), i2c.result());
+    if (stage == STAGE_PRETRIGGER) return true;
+    stage = STAGE_IDLE;
+    return false;
+  }
+
+  void IRAM_ATTR regulate(bool ok, uint16_t raw) {
+    uint8_t flags = 0;
+    uint8_t output = lastOutput;
+    if (!ok) {
+      i2cErrors++;
+      pointer = 0xFF;
+      flags |= CONTROL_FLAG_I2C_ERROR | TELEMETRY_FLAG_SAFETY_OVERRIDE;
+      output = DAC_SAFETY_VALUE;
+    } else {
+      if (writingCalibration) writtenCalibration = active.calibration;
+      if (voltageTick) voltage_V = INA219_BUS_VOLTAGE_V(raw);
+      else current_mA = (int16_t)raw * active.currentLsb_mA;
+
+      if (voltage_V >= MAXIMUM_BUS_VOLTAGE_INA219 && active.setpoint_mA > current_mA) {
+        output = DAC_SAFETY_VALUE;
+        flags |= TELEMETRY_FLAG_SAFETY_OVERRIDE;
+      } else if (!voltageTick) {
+        // Voltage ticks carry no fresh current, so the PID only runs on
+        // current ticks and holds its output in between.
+        output = (uint8_t)constrain((int)compute(current_mA, active.setpoint_mA), 1, 255);
+      }
+    }
+    if (flags & TELEMETRY_FLAG_SAFETY_OVERRIDE) track(output, current_mA);
+    if (output != lastOutput) {
+      fastControlWriteOutput(output);
+      lastOutput = output;
+    }
+
+    // Pre-trigger: leave the pointer on the register the next tick reads.
+    if (ok) {
+      uint8_t next = (tickCount + 1) % CONTROL_VOLTAGE_DECIMATION == 0 ? INA219_REG_BUS_VOLTAGE : INA219_REG_CURRENT;
+      if (pointer != next) {
+        i2c.clear();
+        i2c.queueSetPointer(INA219_ADDRESS, next);
+        pointer = next;
+        stage = STAGE_PRETRIGGER;
+      }
+    }
+
+    FastControlSample sample = {(uint32_t)micros(), active.version, current_mA, voltage_V, active.setpoint_mA, output, flags,
+                                ok && !voltageTick};
+    if (!samples.push(sample)) droppedSamples++;
+  }
+
+  // PID_v1's algorithm (proportional on error, derivative on measurement,
+  // integral clamped to the output range) with a fixed sample time.
+  float IRAM_ATTR compute(float input, float setpoint) {
+    float error = setpoint - input;
+    float dInput = input - lastInput;
+    outputSum += kiDt * error;
+    if (outputSum > 255) outputSum = 255;
+    else if (outputSum < 0) outputSum = 0;
+    float out = active.kp * error + outputSum - kdDt * dInput;
+    lastInput = input;
+    if (out > 255) return 255;
+    if (out < 0) return 0;
+    return out;
+  }
+
+  // Output tracking while overridden: the integral follows the applied
+  // output and the derivative the measurement, so regulation resumes from
+  // where the override left the output instead of from a stale state.
+  void IRAM_ATTR track(uint8_t output, float input) {
+    outputSum = output;
+    lastInput = input;
+  }
+
+  void IRAM_ATTR retune(const FastControlParams &p) {
+    kiDt = p.ki * dt_s;
+    kdDt = p.kd / dt_s;
+  }
+
+  SoftI2c i2c;
+  SeqLock<FastControlParams> params;
+  SpscRing<FastControlSample, 32> samples;
+  FastControlParams active = {};
+  uint32_t periodCycles = 0;
+  float dt_s = 0;
+  float kiDt = 0;
+  float kdDt = 0;
+  float outputSum = 0;
+  float lastInput = 0;
+  float current_mA = 0;
+  float voltage_V = 0;
+  uint8_t pointer = 0xFF;
+  uint8_t lastOutput = 0;
+  uint16_t writtenCalibration = 0;
+  bool writingCalibration = false;
+  bool voltageTick = false;
+  volatile Stage stage = STAGE_IDLE;
+  uint32_t tickCount = 0;
+  uint32_t lastStartCycles = 0;
+  uint32_t nextTickCycles = 0;
+  uint32_t phaseCycles = 0;
+  uint32_t minLeadCycles = 0;
+  volatile uint32_t overruns = 0;
+  volatile uint32_t i2cErrors = 0;
+  volatile uint32_t droppedSamples = 0;
+  volatile uint32_t maxStepCycles = 0;
+  volatile uint32_t maxJitterCycles = 0;
+};
+
+FastControlLoop *FastControlLoop::instance = nullptr;
+
+// INA219 calibration for a full-scale current, matching the unnormalised
+// formula from the datasheet: Cal = trunc(0.04096 / (Current_LSB * Rshunt)).
+inline void ina219Calibration(double maxCurrent_A, double shunt_ohm, uint16_t &calibration, float &currentLsb_mA) {
+  double lsb_A = maxCurrent_A / 32768.0;
+  double cal = 0.04096 / (lsb_A * shunt_ohm);
+  if (cal > 0xFFFE) cal = 0xFFFE;
+  calibration = (uint16_t)cal & 0xFFFE; // Bit 0 is reserved
+  currentLsb_mA = (float)(0.04096 / (calibration * shunt_ohm) * 1000.0);
+}
+
+#endif
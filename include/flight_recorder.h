@@ -0,0 +1,144 @@
+#pragma once
+
+// flight_recorder.h
+//
+// Keeps the last control samples and events in memory that survives a
+// watchdog reset, panic or brownout, so the next boot can report what led
+// up to it:
+//
+//   ESP32:   a FlightLog placed in RTC slow memory with RTC_NOINIT_ATTR
+//            by the caller and passed to begin().
+//   ESP8266: RTC user memory, past the first FLIGHT_RTC_BASE_BLOCK blocks
+//            that OTA updates overwrite. Only 384 bytes are left there, so
+//            the log is much shorter.
+//
+// Each record lands in the slot its sequence number selects, so recording
+// is one fixed-size store with no head pointer to update. begin() copies
+// whatever the previous run left into RAM, then starts a new log.
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <string.h>
+#include "event_log.h"
+
+#ifndef ESP8266
+  #include <esp_system.h>
+#endif
+
+#define FLIGHT_LOG_MAGIC 0x464C5431 // "FLT1"
+#define FLIGHT_RTC_BASE_BLOCK 32    // ESP8266: first RTC user block used
+
+struct __attribute__((packed)) FlightSample {
+  uint32_t seq;          // Control sample sequence number; 0 = empty slot
+  uint32_t timestamp_us;
+  float current_mA;
+  uint16_t voltage_mV;
+  uint8_t output;
+  uint8_t flags;         // TELEMETRY_FLAG_*
+};
+
+template <uint16_t Samples, uint8_t Events>
+struct FlightLog {
+  uint32_t magic;
+  uint32_t boots; // Runs recorded since the log was last initialised
+  FlightSample samples[Samples];
+  EventRecord events[Events];
+};
+
+// Why the chip last reset, in the platform's own terms.
+String resetReason() {
+#ifdef ESP8266
+  return ESP.getResetReason();
+#else
+  static const char *const names[] = {
+    "unknown", "power on", "external", "software", "panic", "interrupt watchdog",
+    "task watchdog", "other watchdog", "deep sleep", "brownout", "SDIO"};
+  uint32_t reason = (uint32_t)esp_reset_reason();
+  return reason < sizeof(names) / sizeof(names[0]) ? names[reason] : "unknown";
+#endif
+}
+
+template <uint16_t Samples, uint8_t Events>
+class FlightRecorder {
+  static_assert(sizeof(FlightSample) % 4 == 0 && sizeof(EventRecord) % 4 == 0, "RTC stores are whole words");
+
+public:
+  typedef FlightLog<Samples, Events> Log;
+
+#ifdef ESP8266
+  static_assert(sizeof(Log) <= 512 - FLIGHT_RTC_BASE_BLOCK * 4, "Does not fit RTC user memory");
+#endif
+
+  // memory is the RTC_NOINIT_ATTR log on the ESP32 and ignored on the
+  // ESP8266. Returns true if the previous run left a log.
+  bool begin(Log *memory) {
+    this->memory = memory;
+    load(0, &previous, sizeof(previous));
+    hasPrevious = previous.magic == FLIGHT_LOG_MAGIC;
+
+    uint32_t header[2] = {FLIGHT_LOG_MAGIC, hasPrevious ? previous.boots + 1 : 1};
+    FlightSample emptySample = {};
+    EventRecord emptyEvent = {};
+    for (uint16_t i = 0; i < Samples; i++) store(offsetof(Log, samples) + i * sizeof(FlightSample), &emptySample, sizeof(emptySample));
+    for (uint8_t i = 0; i < Events; i++) store(offsetof(Log, events) + i * sizeof(EventRecord), &emptyEvent, sizeof(emptyEvent));
+    store(0, header, sizeof(header));
+    return hasPrevious;
+  }
+
+  void recordSample(const FlightSample &sample) {
+    store(offsetof(Log, samples) + (sample.seq % Samples) * sizeof(FlightSample), &sample, sizeof(sample));
+  }
+
+  void recordEvent(const EventRecord &event) {
+    store(offsetof(Log, events) + (event.seq % Events) * sizeof(EventRecord), &event, sizeof(event));
+  }
+
+  // The previous run's log, valid only if hasPreviousLog().
+  bool hasPreviousLog() const { return hasPrevious; }
+  const Log &getPreviousLog() const { return previous; }
+
+  // Slot to start from to visit a ring in sequence order: the one after
+  // the highest sequence number.
+  template <typename Record>
+  static uint16_t oldestSlot(const Record *records, uint16_t count) {
+    uint16_t newest = 0;
+    for (uint16_t i = 1; i < count; i++) {
+      if (records[i].seq > records[newest].seq) newest = i;
+    }
+    return (newest + 1) % count;
+  }
+
+private:
+  // Word-wide copies: the ESP32's RTC slow memory is only meant to be
+  // accessed 32 bits at a time.
+  void store(size_t offset, const void *data, size_t size) {
+#ifdef ESP8266
+    uint32_t words[sizeof(EventRecord) / 4];
+    memcpy(words, data, size);
+    ESP.rtcUserMemoryWrite(FLIGHT_RTC_BASE_BLOCK + offset / 4, words, size);
+#else
+    volatile uint32_t *target = (volatile uint32_t *)((uint8_t *)memory + offset);
+    for (size_t i = 0; i < size / 4; i++) {
+      uint32_t word;
+      memcpy(&word, (const uint8_t *)data + i * 4, 4);
+      target[i] = word;
+    }
+#endif
+  }
+
+  void load(size_t offset, void *data, size_t size) {
+#ifdef ESP8266
+    ESP.rtcUserMemoryRead(FLIGHT_RTC_BASE_BLOCK + offset / 4, (uint32_t *)data, size);
+#else
+    const volatile uint32_t *source = (const volatile uint32_t *)((const uint8_t *)memory + offset);
+    for (size_t i = 0; i < size / 4; i++) {
+      uint32_t word = source[i];
+      memcpy((uint8_t *)data + i * 4, &word, 4);
+    }
+#endif
+  }
+
+  Log *memory = nullptr;
+  Log previous;
+  bool hasPrevious = false;
+};
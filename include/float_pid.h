@@ -0,0 +1,158 @@
+#pragma once
+
+// float_pid.h
+//
+// Port of the PID_v1 library (br3ttb) that is templated on its number
+// type. PID_v1 works in double, which the ESP32 FPU does not accelerate;
+// FloatPID runs the same algorithm in single precision with the same API,
+// so it can stand in for myPID unchanged (see CONTROL_FLOAT_PID).
+//
+// BasicPID<double> reproduces PID_v1's arithmetic step for step and is the
+// reference the float variant is checked against: on the device by
+// SYSTem:PID:BENChmark?, on a host by tools/pid_bench.cpp over recorded
+// telemetry. This header has no Arduino dependencies apart from Compute(),
+// which reads millis(); ComputeAt() takes the time explicitly.
+
+#include <stdint.h>
+
+#ifndef AUTOMATIC // Same values as PID_v1.h
+  #define AUTOMATIC 1
+  #define MANUAL 0
+  #define DIRECT 0
+  #define REVERSE 1
+  #define P_ON_M 0
+  #define P_ON_E 1
+#endif
+
+template <typename Real>
+class BasicPID {
+public:
+  BasicPID(Real *input, Real *output, Real *setpoint, Real kp, Real ki, Real kd, int pOn, int direction)
+      : myInput(input), myOutput(output), mySetpoint(setpoint) {
+    SetOutputLimits(0, 255);
+    SetControllerDirection(direction);
+    SetTunings(kp, ki, kd, pOn);
+  }
+
+  BasicPID(Real *input, Real *output, Real *setpoint, Real kp, Real ki, Real kd, int direction)
+      : BasicPID(input, output, setpoint, kp, ki, kd, P_ON_E, direction) {}
+
+  #ifdef ARDUINO
+    bool Compute() { return ComputeAt(millis()); }
+  #endif
+
+  // Runs one step if at least the sample time has passed since the last.
+  bool ComputeAt(unsigned long now) {
+    if (!inAuto) return false;
+    if (started && now - lastTime < sampleTime) return false;
+
+    Real input = *myInput;
+    Real error = *mySetpoint - input;
+    Real dInput = input - lastInput;
+    outputSum += ki * error;
+    if (!pOnE) outputSum -= kp * dInput;
+    outputSum = clamp(outputSum);
+
+    Real output = pOnE ? kp * error : 0;
+    output += outputSum - kd * dInput;
+    *myOutput = clamp(output);
+
+    lastInput = input;
+    lastTime = now;
+    started = true;
+    return true;
+  }
+
+  void SetTunings(Real Kp, Real Ki, Real Kd, int POn) {
+    if (Kp < 0 || Ki < 0 || Kd < 0) return;
+    pOn = POn;
+    pOnE = POn == P_ON_E;
+    dispKp = Kp;
+    dispKi = Ki;
+    dispKd = Kd;
+
+    Real sampleTimeInSec = (Real)sampleTime / 1000;
+    kp = Kp;
+    ki = Ki * sampleTimeInSec;
+    kd = Kd / sampleTimeInSec;
+    if (controllerDirection == REVERSE) {
+      kp = -kp;
+      ki = -ki;
+      kd = -kd;
+    }
+  }
+
+  void SetTunings(Real Kp, Real Ki, Real Kd) { SetTunings(Kp, Ki, Kd, pOn); }
+
+  void SetSampleTime(int newSampleTime) {
+    if (newSampleTime <= 0) return;
+    Real ratio = (Real)newSampleTime / (Real)sampleTime;
+    ki *= ratio;
+    kd /= ratio;
+    sampleTime = (unsigned long)newSampleTime;
+  }
+
+  void SetOutputLimits(Real min, Real max) {
+    if (min >= max) return;
+    outMin = min;
+    outMax = max;
+    if (inAuto) {
+      *myOutput = clamp(*myOutput);
+      outputSum = clamp(outputSum);
+    }
+  }
+
+  // Switching to AUTOMATIC re-initialises from the current output, so the
+  // transfer is bumpless.
+  void SetMode(int mode) {
+    bool newAuto = mode == AUTOMATIC;
+    if (newAuto && !inAuto) {
+      outputSum = clamp(*myOutput);
+      lastInput = *myInput;
+    }
+    inAuto = newAuto;
+  }
+
+  void SetControllerDirection(int direction) {
+    if (inAuto && direction != controllerDirection) {
+      kp = -kp;
+      ki = -ki;
+      kd = -kd;
+    }
+    controllerDirection = direction;
+  }
+
+  Real GetKp() const { return dispKp; }
+  Real GetKi() const { return dispKi; }
+  Real GetKd() const { return dispKd; }
+  int GetMode() const { return inAuto ? AUTOMATIC : MANUAL; }
+  int GetDirection() const { return controllerDirection; }
+
+private:
+  Real clamp(Real value) const {
+    if (value > outMax) return outMax;
+    if (value < outMin) return outMin;
+    return value;
+  }
+
+  Real *myInput;
+  Real *myOutput;
+  Real *mySetpoint;
+
+  Real dispKp = 0, dispKi = 0, dispKd = 0; // As given, for the getters
+  Real kp = 0, ki = 0, kd = 0;             // Scaled to the sample time
+  int controllerDirection = DIRECT;
+  int pOn = P_ON_E;
+  bool pOnE = true;
+
+  unsigned long sampleTime = 100; // ms, PID_v1's default
+  unsigned long lastTime = 0;
+  bool started = false;
+  Real outputSum = 0;
+  Real lastInput = 0;
+  Real outMin = 0;
+  Real outMax = 255;
+  bool inAuto = false;
+};
+
+typedef BasicPID<float> FloatPID;
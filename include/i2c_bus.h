@@ -0,0 +1,49 @@
+#pragma once
+
+// i2c_bus.h
+//
+// Bus-level helpers shared by the Wire-based INA219 paths: a register read
+// that reports Wire's error code instead of returning garbage, and the
+// standard recovery for a slave that holds SDA low after an interrupted
+// transfer.
+
+#include <Arduino.h>
+#include <Wire.h>
+
+// Blocking read of a big-endian 16-bit register. Returns 0 on success or
+// the Wire error code (endTransmission's codes; 4 also covers short reads).
+inline uint8_t i2cReadRegister16(TwoWire &wire, uint8_t address, uint8_t reg, uint16_t &value) {
+  wire.beginTransmission(address);
+  wire.write(reg);
+  uint8_t error = wire.endTransmission(false); // Repeated start
+  if (error != 0) return error;
+  if (wire.requestFrom(address, (uint8_t)2) != 2) return 4;
+  uint8_t hi = wire.read();
+  uint8_t lo = wire.read();
+  value = (uint16_t)(hi << 8 | lo);
+  return 0;
+}
+
+// Clocks SCL until a slave stuck mid-byte lets go of SDA (at most nine
+// pulses), then sends a STOP. Wire must be stopped first and restarted
+// afterwards. Takes about 100 us. Returns false if SDA is still held low.
+inline bool i2cClearBus(uint8_t sdaPin, uint8_t sclPin) {
+  // Open drain by hand: drive low, or release to the pull-up.
+  pinMode(sdaPin, INPUT_PULLUP);
+  pinMode(sclPin, INPUT_PULLUP);
+  delayMicroseconds(5);
+  for (uint8_t i = 0; i < 9 && digitalRead(sdaPin) == LOW; i++) {
+    pinMode(sclPin, OUTPUT);
+    digitalWrite(sclPin, LOW);
+    delayMicroseconds(5);
+    pinMode(sclPin, INPUT_PULLUP);
+    delayMicroseconds(5);
+  }
+  // STOP: SDA rises while SCL is high.
+  pinMode(sdaPin, OUTPUT);
+  digitalWrite(sdaPin, LOW);
+  delayMicroseconds(5);
+  pinMode(sdaPin, INPUT_PULLUP);
+  delayMicroseconds(5);
+  return digitalRead(sdaPin) == HIGH && digitalRead(sclPin) == HIGH;
+}
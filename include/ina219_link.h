@@ -0,0 +1,194 @@
+#pragma once
+
+// ina219_link.h
+//
+// Error detection and recovery for the INA219 on the Wire bus, in steps
+// short enough to run inside a control period.
+//
+// Reads report Wire's error code, and I2C_TIMEOUT_MS bounds a transaction
+// that would otherwise wait on a stuck bus. After I2C_FAULT_THRESHOLD
+// consecutive failures the link is degraded: the caller holds the output
+// safe and calls service() once per tick while nothing else is using the
+// bus. Each call runs at most one recovery stage:
+//
+//   BUS_CLEAR  stop Wire, clock SCL until SDA is released, send a STOP and
+//              restart Wire (about 100 us)
+//   CALIBRATE  rewrite the calibration register
+//   CONFIGURE  rewrite the ADC and mode configuration
+//   PROBE      a test read; success returns the link to healthy
+//
+// A failed stage starts over at BUS_CLEAR after a delay that doubles from
+// I2C_RETRY_MIN_MS up to I2C_RETRY_MAX_MS.
+//
+// Counters may be read from another task; everything else belongs to the
+// task that owns the bus.
+
+#include <Arduino.h>
+#include <INA219.h>
+#include <Wire.h>
+#include "config.h"
+#include "i2c_bus.h"
+#include "ina219_registers.h"
+
+enum Ina219LinkStage : uint8_t {
+  LINK_HEALTHY,
+  LINK_BUS_CLEAR,
+  LINK_CALIBRATE,
+  LINK_CONFIGURE,
+  LINK_PROBE,
+};
+
+class Ina219Link {
+public:
+  Ina219Link(INA219 &sensor, TwoWire &wire) : sensor(sensor), wire(wire) {}
+
+  // Starts Wire with the transaction timeout. Call before the sensor's own
+  // begin().
+  void begin(uint8_t sdaPin, uint8_t sclPin, uint32_t clock_hz) {
+    this->sdaPin = sdaPin;
+    this->sclPin = sclPin;
+    this->clock_hz = clock_hz;
+    startWire();
+  }
+
+  // Blocking reads, bounded by the Wire timeout. False on error, leaving
+  // the value untouched.
+  bool readCurrent(float &current_mA) {
+    uint16_t raw;
+    if (!readRegister(INA219_REG_CURRENT, raw)) return false;
+    current_mA = (int16_t)raw * sensor.getCurrentLSB_mA();
+    return true;
+  }
+
+  bool readBusVoltage(float &voltage_V) {
+    uint16_t raw;
+    if (!readRegister(INA219_REG_BUS_VOLTAGE, raw)) return false;
+    voltage_V = INA219_BUS_VOLTAGE_V(raw);
+    return true;
+  }
+
+  // Outcome of a read made elsewhere (the async worker). Returns the
+  // outcome as counted, which an injected fault turns into a failure.
+  bool report(bool ok, uint8_t error = 0) {
+#if I2C_FAULT_INJECTION
+    if (ok && injectedFaults > 0) {
+      injectedFaults--;
+      ok = false;
+      error = 5;
+    }
+#endif
+    if (ok) {
+      consecutiveErrors = 0;
+      return true;
+    }
+    errors++;
+    lastError = error;
+    if (consecutiveErrors < UINT8_MAX) consecutiveErrors++;
+    if (consecutiveErrors >= I2C_FAULT_THRESHOLD && stage == LINK_HEALTHY) degrade();
+    return false;
+  }
+
+  // Marks the sensor as lost straight away, e.g. when setup() cannot find it.
+  void degrade() {
+    stage = LINK_BUS_CLEAR;
+    retryDelay_ms = I2C_RETRY_MIN_MS;
+    lastAttempt_ms = millis();
+    degradations++;
+  }
+
+  // Runs one recovery stage if the link is degraded and the next attempt
+  // is due. Call only while no other transaction is in flight. Returns
+  // true on the call that restores the link.
+  bool service(double maxCurrent_mA) {
+    if (stage == LINK_HEALTHY) return false;
+    uint32_t now_ms = millis();
+    if (stage == LINK_BUS_CLEAR && now_ms - lastAttempt_ms < retryDelay_ms) return false;
+
+    bool ok = false;
+    uint16_t raw;
+    switch (stage) {
+      case LINK_BUS_CLEAR:
+        attempts++;
+        #ifndef ESP8266
+          wire.end(); // The ESP32 driver ignores begin() on a running bus
+        #endif
+        ok = i2cClearBus(sdaPin, sclPin);
+        startWire();
+        break;
+      case LINK_CALIBRATE:
+        ok = sensor.setMaxCurrentShunt(maxCurrent_mA / 1000.0, SHUNT_RESISTOR_OHMS);
+        break;
+      case LINK_CONFIGURE:
+        ok = sensor.setShuntADC(INA219_SHUNT_ADC) && sensor.setBusADC(INA219_BUS_ADC) &&
+             sensor.setModeShuntBusContinuous();
+        break;
+      default:
+        ok = i2cReadRegister16(wire, INA219_ADDRESS, INA219_REG_CURRENT, raw) == 0;
+        break;
+    }
+
+    if (!ok) {
+      stage = LINK_BUS_CLEAR;
+      lastAttempt_ms = now_ms;
+      retryDelay_ms = retryDelay_ms * 2 < I2C_RETRY_MAX_MS ? retryDelay_ms * 2 : I2C_RETRY_MAX_MS;
+      return false;
+    }
+    if (stage != LINK_PROBE) {
+      stage = (Ina219LinkStage)(stage + 1);
+      return false;
+    }
+    stage = LINK_HEALTHY;
+    consecutiveErrors = 0;
+    recoveries++;
+    return true;
+  }
+
+#if I2C_FAULT_INJECTION
+  // Fails the next count reads, to exercise detection and recovery.
+  void injectFaults(uint16_t count) { injectedFaults = count; }
+#endif
+
+  bool isDegraded() const { return stage != LINK_HEALTHY; }
+  uint8_t getLastError() const { return lastError; }
+  uint32_t getErrors() const { return errors; }
+  uint32_t getDegradations() const { return degradations; }
+  uint32_t getAttempts() const { return attempts; }
+  uint32_t getRecoveries() const { return recoveries; }
+
+private:
+  bool readRegister(uint8_t reg, uint16_t &raw) {
+    uint8_t error = i2cReadRegister16(wire, INA219_ADDRESS, reg, raw);
+    return report(error == 0, error);
+  }
+
+  void startWire() {
+    wire.begin(sdaPin, sclPin);
+    wire.setClock(clock_hz);
+    #ifdef ESP8266
+      wire.setClockStretchLimit(I2C_TIMEOUT_MS * 1000);
+    #else
+      static_assert(I2C_TIMEOUT_MS >= 2, "A one-tick Wire timeout can expire mid-transfer");
+      wire.setTimeOut(I2C_TIMEOUT_MS);
+    #endif
+  }
+
+  INA219 &sensor;
+  TwoWire &wire;
+  uint8_t sdaPin = 0;
+  uint8_t sclPin = 0;
+  uint32_t clock_hz = 0;
+
+  volatile Ina219LinkStage stage = LINK_HEALTHY;
+  uint8_t consecutiveErrors = 0;
+  uint8_t lastError = 0;
+  uint32_t retryDelay_ms = I2C_RETRY_MIN_MS;
+  uint32_t lastAttempt_ms = 0;
+#if I2C_FAULT_INJECTION
+  uint16_t injectedFaults = 0;
+#endif
+
+  volatile uint32_t errors = 0;
+  volatile uint32_t degradations = 0;
+  volatile uint32_t attempts = 0;
+  volatile uint32_t recoveries = 0;
+};
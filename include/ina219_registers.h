@@ -0,0 +1,16 @@
+#pragma once
+
+// ina219_registers.h
+//
+// INA219 register map, for the paths that talk to the chip directly
+// instead of through the INA219 library.
+
+#define INA219_REG_CONFIG 0x00
+#define INA219_REG_SHUNT_VOLTAGE 0x01
+#define INA219_REG_BUS_VOLTAGE 0x02
+#define INA219_REG_POWER 0x03
+#define INA219_REG_CURRENT 0x04
+#define INA219_REG_CALIBRATION 0x05
+
+// Bus voltage register: value in bits 15..3, 4 mV per LSB.
+#define INA219_BUS_VOLTAGE_V(raw) (((raw) >> 3) * 0.004f)
@@ -99,16 +99,46 @@ let chartDataPoints = 60;
 let updateIntervalHandle;
 let updateIntervalMs = 1000;
 
+// /data is fetched as the packed DataSnapshot struct followed by the
+// DataAggregate for this page (see telemetry_frame.h), so the chart shows
+// the min/max envelope of every control sample between polls.
+const clientId = Math.random().toString(36).slice(2, 10);
+
+function parseSnapshot(buffer) {
+    const view = new DataView(buffer);
+    const round2 = v => Math.round(v * 100) / 100;
+    const data = {
+        seq: view.getUint32(4, true),
+        voltage: round2(view.getFloat32(8, true)),
+        current: round2(view.getFloat32(12, true)),
+        setpoint: round2(view.getFloat32(16, true)),
+        kp: round2(view.getFloat32(20, true)),
+        ki: round2(view.getFloat32(24, true)),
+        kd: round2(view.getFloat32(28, true)),
+        max_limit: round2(view.getFloat32(32, true))
+    };
+    if (buffer.byteLength >= 36 + 28) {
+        data.count = view.getUint32(36, true);
+        data.current_min = round2(view.getFloat32(40, true));
+        data.current_max = round2(view.getFloat32(44, true));
+        data.current_mean = round2(view.getFloat32(48, true));
+        data.voltage_min = round2(view.getFloat32(52, true));
+        data.voltage_max = round2(view.getFloat32(56, true));
+        data.voltage_mean = round2(view.getFloat32(60, true));
+    }
+    return data;
+}
+
 function fetchData() {
-    fetch('/data')
-      .then(response => response.ok ? response.json() : Promise.reject('Network response was not ok'))
-      .then(data => updateUI(data))
+    fetch(`/data?agg=1&cid=${clientId}`, { headers: { 'Accept': 'application/octet-stream' } })
+      .then(response => response.ok ? response.arrayBuffer() : Promise.reject('Network response was not ok'))
+      .then(buffer => updateUI(parseSnapshot(buffer)))
       .catch(error => console.error('Error fetching data:', error));
 }
 
 function updateUI(data) {
-    document.getElementById('voltage').innerText = data.voltage;
-    document.getElementById('current').innerText = data.current;
+    document.getElementById('voltage').innerText = data.voltage.toFixed(2);
+    document.getElementById('current').innerText = data.current.toFixed(2);
     
     document.getElementById('voltageWarning').style.display = data.voltage >= 25 ? 'inline' : 'none';
     
@@ -128,7 +158,11 @@ function updateUI(data) {
     if (activeId !== 'kd') document.getElementById('kd').value = data.kd;
     
     const time = new Date().toLocaleTimeString();
-    addDataToChart(time, data.current, data.setpoint, data.voltage);
+    if (data.count > 0) {
+        addDataToChart(time, data.current_mean, data.setpoint, data.voltage_mean, data.current_min, data.current_max);
+    } else {
+        addDataToChart(time, data.current, data.setpoint, data.voltage, data.current, data.current);
+    }
 }
 
 function showButtonFeedback(button, originalText, success) {
@@ -156,7 +190,9 @@ window.onload = function() {
     data: { labels: [], datasets: [
         { label: 'Measured Current (mA)', yAxisID: 'yCurrent', data: [], borderColor: 'rgba(24, 119, 242, 1)', backgroundColor: 'rgba(24, 119, 242, 0.2)', borderWidth: 2, fill: true, tension: 0.4 }, 
         { label: 'Setpoint (mA)', yAxisID: 'yCurrent', data: [], borderColor: 'rgba(40, 167, 69, 1)', borderWidth: 2, borderDash: [5, 5], fill: false },
-		{ label: 'Measured Voltage (V)', yAxisID: 'yVoltage', data: [], borderColor: 'rgba(219, 59, 55, 1)', backgroundColor: 'rgba(219, 59, 55, 0.2)', borderWidth: 2, fill: true, tension: 0.4 }
+		{ label: 'Measured Voltage (V)', yAxisID: 'yVoltage', data: [], borderColor: 'rgba(219, 59, 55, 1)', backgroundColor: 'rgba(219, 59, 55, 0.2)', borderWidth: 2, fill: true, tension: 0.4 },
+        { label: 'Current Max (mA)', yAxisID: 'yCurrent', data: [], borderColor: 'rgba(24, 119, 242, 0.4)', borderWidth: 1, pointRadius: 0, fill: false },
+        { label: 'Current Min (mA)', yAxisID: 'yCurrent', data: [], borderColor: 'rgba(24, 119, 242, 0.4)', backgroundColor: 'rgba(24, 119, 242, 0.15)', borderWidth: 1, pointRadius: 0, fill: '-1' }
     ]},
     options: {
       scales: { 
@@ -206,11 +242,13 @@ function setAdvancedSettings(button) {
      .catch(err => showButtonFeedback(button, 'Set Advanced', false));
 }
 
-function addDataToChart(label, current, setpoint, voltage) {
+function addDataToChart(label, current, setpoint, voltage, currentMin, currentMax) {
     chart.data.labels.push(label);
     chart.data.datasets[0].data.push(current);
     chart.data.datasets[1].data.push(setpoint);
 	chart.data.datasets[2].data.push(voltage);
+    chart.data.datasets[3].data.push(currentMax);
+    chart.data.datasets[4].data.push(currentMin);
     while(chart.data.labels.length > chartDataPoints) {
         chart.data.labels.shift();
         chart.data.datasets.forEach(dataset => dataset.data.shift());
@@ -219,13 +257,15 @@ function addDataToChart(label, current, setpoint, voltage) {
 }
 
 function downloadCSV() {
-    let csvContent = "data:text/csv;charset=utf-8,Time,Measured Current (mA),Setpoint (mA),Measured Voltage (V)\n";
+    let csvContent = "data:text/csv;charset=utf-8,Time,Measured Current (mA),Setpoint (mA),Measured Voltage (V),Current Min (mA),Current Max (mA)\n";
     const labels = chart.data.labels;
     const currentData = chart.data.datasets[0].data;
     const setpointData = chart.data.datasets[1].data;
     const voltageData = chart.data.datasets[2].data;
+    const maxData = chart.data.datasets[3].data;
+    const minData = chart.data.datasets[4].data;
     for (let i = 0; i < labels.length; i++) {
-        csvContent += `${labels[i]},${currentData[i]},${setpointData[i]},${voltageData[i]}\n`;
+        csvContent += `${labels[i]},${currentData[i]},${setpointData[i]},${voltageData[i]},${minData[i]},${maxData[i]}\n`;
     }
     var encodedUri = encodeURI(csvContent);
     var link = document.createElement("a");
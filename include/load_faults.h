@@ -0,0 +1,95 @@
+#pragma once
+
+// load_faults.h
+//
+// Open- and short-circuit detection, run once per control tick.
+//
+//   open circuit:  output at its limit (saturated, capped by the
+//                  compliance guard or overridden), current near zero,
+//                  voltage rising or already high. Without this an open
+//                  load winds the PID up to full output and leaves it there.
+//   short circuit: current flowing with the voltage near zero.
+//
+// A condition has to hold for LOAD_FAULT_CONFIRM_TICKS consecutive ticks
+// before it is reported, so the action is taken within one or two control
+// periods. Faults latch until clear() is called.
+
+#include <stdint.h>
+
+enum LoadFault : uint8_t {
+  LOAD_FAULT_NONE,
+  LOAD_FAULT_OPEN,
+  LOAD_FAULT_SHORT,
+};
+
+// What the control step does while a fault is latched.
+enum LoadFaultAction : uint8_t {
+  LOAD_FAULT_ACTION_REPORT,      // Flag and count only
+  LOAD_FAULT_ACTION_SAFE_OUTPUT, // Hold DAC_SAFETY_VALUE
+  LOAD_FAULT_ACTION_MIN_OUTPUT,  // Hold the lowest output code
+};
+
+const char *loadFaultName(LoadFault fault) {
+  switch (fault) {
+    case LOAD_FAULT_OPEN: return "open";
+    case LOAD_FAULT_SHORT: return "short";
+    default: return "none";
+  }
+}
+
+struct LoadFaultThresholds {
+  uint8_t confirmTicks;
+  float openCurrent_mA;     // Below this counts as no current
+  float openVoltage_V;      // At or above this counts as high
+  float shortCurrent_mA;    // Above this counts as current flowing
+  float shortVoltage_V;     // Below this counts as near zero
+};
+
+class LoadFaultDetector {
+public:
+  void begin(const LoadFaultThresholds &thresholds) {
+    this->thresholds = thresholds;
+    clear();
+  }
+
+  // Returns the latched fault. Returns true through raised when a fault
+  // was latched on this tick.
+  LoadFault update(float current_mA, float voltage_V, float voltageSlope_VPerS, bool outputLimited, bool &raised) {
+    raised = false;
+    if (latched != LOAD_FAULT_NONE) return latched;
+
+    bool open = outputLimited && current_mA < thresholds.openCurrent_mA &&
+                (voltageSlope_VPerS > 0 || voltage_V >= thresholds.openVoltage_V);
+    bool shorted = current_mA > thresholds.shortCurrent_mA && voltage_V < thresholds.shortVoltage_V;
+
+    openTicks = open ? openTicks + 1 : 0;
+    shortTicks = shorted ? shortTicks + 1 : 0;
+    if (openTicks >= thresholds.confirmTicks) {
+      latched = LOAD_FAULT_OPEN;
+      openCount++;
+    } else if (shortTicks >= thresholds.confirmTicks) {
+      latched = LOAD_FAULT_SHORT;
+      shortCount++;
+    }
+    raised = latched != LOAD_FAULT_NONE;
+    return latched;
+  }
+
+  void clear() {
+    latched = LOAD_FAULT_NONE;
+    openTicks = 0;
+    shortTicks = 0;
+  }
+
+  LoadFault getFault() const { return latched; }
+  uint32_t getOpenCount() const { return openCount; }
+  uint32_t getShortCount() const { return shortCount; }
+
+private:
+  LoadFaultThresholds thresholds = {};
+  LoadFault latched = LOAD_FAULT_NONE;
+  uint8_t openTicks = 0;
+  uint8_t shortTicks = 0;
+  uint32_t openCount = 0;
+  uint32_t shortCount = 0;
+};
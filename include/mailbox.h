@@ -0,0 +1,39 @@
+#pragma once
+
+// mailbox.h
+//
+// Single-slot, latest-wins mailbox between one producer and one consumer
+// on different cores. Built on SeqLock, so neither side ever blocks: the
+// producer overwrites a sample the consumer has not taken yet (and counts
+// it), and the consumer sees each posted sample at most once.
+
+#include <atomic>
+#include "seqlock.h"
+
+template <typename T>
+class Mailbox {
+public:
+  // Producer side.
+  void post(const T &value) {
+    if (slot.version() != taken.load(std::memory_order_acquire)) overwritten++;
+    slot.write(value);
+  }
+
+  // Consumer side. Returns false if nothing new has been posted since the
+  // last take, or if the slot was being rewritten on every attempt.
+  bool take(T &out) {
+    if (slot.version() == taken.load(std::memory_order_relaxed)) return false;
+    uint32_t version;
+    if (!slot.tryRead(out, &version)) return false;
+    taken.store(version, std::memory_order_release);
+    return true;
+  }
+
+  // Samples replaced before the consumer took them.
+  uint32_t getOverwritten() const { return overwritten; }
+
+private:
+  SeqLock<T> slot;
+  std::atomic<uint32_t> taken{0};
+  volatile uint32_t overwritten = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+// output_stage.h
+//
+// DAC/PWM output with a cache of the last written code. The peripheral is
+// only touched when the code changes: dacWrite() on the ESP32 costs a
+// register write, and analogWrite() on the ESP8266 restarts the PWM period
+// on every call, which shows up as ripple on the output. Writes and skips
+// are counted for telemetry.
+
+#include <Arduino.h>
+#include "util.h"
+
+class OutputStage {
+public:
+  explicit OutputStage(uint8_t pin) : pin(pin) {}
+
+  // Writes code if it differs from the last one written. Returns code.
+  int write(int code) {
+    if (code == lastCode) {
+      skips++;
+      return code;
+    }
+    dacWrite(pin, code);
+    lastCode = code;
+    writes++;
+    return code;
+  }
+
+  // Forces the next write through, e.g. after something else drove the pin.
+  void invalidate() { lastCode = -1; }
+
+  int getLastCode() const { return lastCode; }
+  uint32_t getWrites() const { return writes; }
+  uint32_t getSkips() const { return skips; }
+
+private:
+  uint8_t pin;
+  int lastCode = -1;
+  uint32_t writes = 0;
+  uint32_t skips = 0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+// payload_cache.h
+//
+// Serialized response cache. A payload is rebuilt at most once per source
+// tick (control sample or parameter change) no matter how many clients ask
+// for it, and carries a version that only advances when the serialized
+// bytes actually change. The version doubles as an HTTP ETag so polling
+// clients can revalidate and get a 304 at steady state. The version restarts
+// at 0 on every boot, so the ETag also carries a per-boot nonce: a tag held
+// from before a reset never matches the new run's payloads.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+template <size_t Capacity>
+class PayloadCache {
+public:
+  // kind prefixes the ETag so versions of different encodings of the same
+  // resource never collide.
+  explicit PayloadCache(char kind) : kind(kind) {}
+
+  static const size_t ETAG_SIZE = 24; // Quotes, kind, nonce, '-', version
+
+  // Sets the boot nonce. Call before the first request is served, with a
+  // value that differs between boots (e.g. from the hardware RNG).
+  void begin(uint32_t bootNonce) { nonce = bootNonce; }
+
+  // builder(uint8_t *buf, size_t capacity) writes the payload and returns
+  // its length, or 0 if it did not fit. It is only invoked when tick differs
+  // from the last build.
+  template <typename Builder>
+  void refresh(uint32_t tick, Builder builder) {
+    if (valid && tick == builtTick) return;
+    uint8_t scratch[Capacity];
+    size_t len = builder(scratch, Capacity);
+    if (len > Capacity) len = Capacity;
+    if (!valid || len != length || memcmp(scratch, data, len) != 0) {
+      memcpy(data, scratch, len);
+      length = len;
+      version++;
+    }
+    builtTick = tick;
+    valid = true;
+  }
+
+  const uint8_t *bytes() const { return data; }
+  size_t size() const { return length; }
+  uint32_t getVersion() const { return version; }
+
+  // Formats the nonce and version as a quoted HTTP entity tag into out
+  // (ETAG_SIZE bytes).
+  void etag(char *out, size_t outSize) const {
+    snprintf(out, outSize, "\"%c%08lx-%lu\"", kind, (unsigned long)nonce, (unsigned long)version);
+  }
+
+  // True if an If-None-Match header value matches the current version.
+  bool matches(const char *ifNoneMatch) const {
+    char tag[ETAG_SIZE];
+    etag(tag, sizeof(tag));
+    return valid && ifNoneMatch != nullptr && strstr(ifNoneMatch, tag) != nullptr;
+  }
+
+private:
+  char kind;
+  uint32_t nonce = 0;
+  uint8_t data[Capacity];
+  size_t length = 0;
+  uint32_t version = 0;
+  uint32_t builtTick = 0;
+  bool valid = false;
+};
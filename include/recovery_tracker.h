@@ -0,0 +1,49 @@
+#pragma once
+
+// recovery_tracker.h
+//
+// Measures how long regulation takes to come back after a compliance
+// override: from the tick the override is released to the first tick the
+// current is back within a band around the setpoint.
+
+#include <math.h>
+#include <stdint.h>
+
+class RecoveryTracker {
+public:
+  explicit RecoveryTracker(float band_mA) : band_mA(band_mA) {}
+
+  // Called every control tick.
+  void update(uint32_t now_us, bool overridden, float current_mA, float setpoint_mA) {
+    if (overridden) {
+      wasOverridden = true;
+      recovering = false;
+      return;
+    }
+    if (wasOverridden) {
+      wasOverridden = false;
+      recovering = true;
+      releasedAt_us = now_us;
+    }
+    if (recovering && fabsf(current_mA - setpoint_mA) <= band_mA) {
+      recovering = false;
+      last_us = now_us - releasedAt_us;
+      if (last_us > max_us) max_us = last_us;
+      count++;
+    }
+  }
+
+  bool isRecovering() const { return recovering; }
+  uint32_t getCount() const { return count; }
+  uint32_t getLast_us() const { return last_us; }
+  uint32_t getMax_us() const { return max_us; }
+
+private:
+  float band_mA;
+  bool wasOverridden = false;
+  bool recovering = false;
+  uint32_t releasedAt_us = 0;
+  uint32_t count = 0;
+  uint32_t last_us = 0;
+  uint32_t max_us = 0;
+};
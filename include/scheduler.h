@@ -0,0 +1,91 @@
+#pragma once
+
+// scheduler.h
+//
+// Cooperative time-budgeted scheduler for loop(). The control step has hard
+// priority: it runs on a fixed period and is also run from inside long web
+// handlers (between response chunks, while a long-poll is parked). Web work
+// only starts when there is room before the next control deadline and is
+// limited to a budget per control period. Lateness of the control step and
+// web slices that blow their budget are counted so they can be reported.
+
+#include <Arduino.h>
+
+struct SchedulerStats {
+  uint32_t ticks;          // Control steps run
+  uint32_t lateTicks;      // Started more than the tolerance after deadline
+  uint32_t missedTicks;    // Whole periods skipped
+  uint32_t maxLateness_us;
+  uint32_t maxStep_us;     // Longest control step
+  uint32_t webOverruns;    // Web slices longer than the per-tick budget
+  uint32_t maxWebSlice_us;
+};
+
+class CooperativeScheduler {
+public:
+  void begin(uint32_t period_us, uint32_t webBudget_us, uint32_t lateTolerance_us) {
+    this->period_us = period_us;
+    this->webBudget_us = webBudget_us;
+    this->lateTolerance_us = lateTolerance_us;
+    nextDeadline_us = micros();
+    webUsed_us = 0;
+  }
+
+  // Runs step if its deadline has passed. Returns true if it ran.
+  bool runControlIfDue(void (*step)()) {
+    uint32_t start = micros();
+    int32_t lateness = (int32_t)(start - nextDeadline_us);
+    if (lateness < 0) return false;
+
+    step();
+    uint32_t duration = micros() - start;
+
+    stats.ticks++;
+    if ((uint32_t)lateness > stats.maxLateness_us) stats.maxLateness_us = lateness;
+    if ((uint32_t)lateness > lateTolerance_us) stats.lateTicks++;
+    if (duration > stats.maxStep_us) stats.maxStep_us = duration;
+
+    // Stay phase-locked to the original grid; if whole periods were lost,
+    // skip them rather than running a burst of catch-up steps.
+    nextDeadline_us += period_us;
+    if ((int32_t)(micros() - nextDeadline_us) >= 0) {
+      uint32_t behind = (micros() - nextDeadline_us) / period_us + 1;
+      stats.missedTicks += behind;
+      nextDeadline_us += behind * period_us;
+    }
+    webUsed_us = 0;
+    return true;
+  }
+
+  // True if a web slice may start now: this period's budget is not used up
+  // and the slice is not about to run into the next control deadline.
+  bool beginWebSlice() {
+    if (webUsed_us >= webBudget_us) return false;
+    if ((int32_t)(nextDeadline_us - micros()) < (int32_t)(lateTolerance_us)) return false;
+    webStart_us = micros();
+    return true;
+  }
+
+  void endWebSlice() {
+    uint32_t duration = micros() - webStart_us;
+    webUsed_us += duration;
+    if (duration > stats.maxWebSlice_us) stats.maxWebSlice_us = duration;
+    if (duration > webBudget_us) stats.webOverruns++;
+  }
+
+  // Leaves time spent waiting inside the current web slice, such as a
+  // parked long-poll that services the control step, out of its duration.
+  void excludeFromWebSlice(uint32_t duration_us) { webStart_us += duration_us; }
+
+  uint32_t getPeriod() const { return period_us; }
+  const SchedulerStats &getStats() const { return stats; }
+
+private:
+  uint32_t period_us = 0;
+  uint32_t webBudget_us = 0;
+  uint32_t lateTolerance_us = 0;
+  uint32_t nextDeadline_us = 0;
+  uint32_t webStart_us = 0;
+  uint32_t webUsed_us = 0;
+  SchedulerStats stats = {};
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+// scpi.h
+//
+// Minimal SCPI-style command interpreter. Each input stream (Serial, a TCP
+// session) owns one ScpiSession holding a fixed line buffer; nothing is
+// allocated on the heap while parsing or dispatching.
+//
+// Command headers are written in the usual SCPI mixed-case form, e.g.
+// "SOURce:CURRent", where the upper-case letters are the short form. Both
+// the short ("SOUR:CURR") and long ("SOURCE:CURRENT") spellings are
+// accepted, case-insensitively. Queries carry a trailing '?'.
+
+#include <Arduino.h>
+
+#define SCPI_MAX_LINE 64
+#define SCPI_ERROR_QUEUE_LEN 8
+
+// Standard SCPI error codes used by this firmware.
+#define SCPI_ERR_NONE 0
+#define SCPI_ERR_COMMAND -100
+#define SCPI_ERR_DATA_TYPE -104
+#define SCPI_ERR_MISSING_PARAMETER -109
+#define SCPI_ERR_UNDEFINED_HEADER -113
+#define SCPI_ERR_EXECUTION -200
+#define SCPI_ERR_DATA_OUT_OF_RANGE -222
+#define SCPI_ERR_QUEUE_OVERFLOW -350
+#define SCPI_ERR_INPUT_BUFFER_OVERRUN -363
+
+struct ScpiContext;
+typedef void (*ScpiHandler)(ScpiContext &ctx);
+
+struct ScpiCommand {
+  const char *pattern; // e.g. "MEASure:CURRent?"
+  ScpiHandler handler;
+};
+
+const char *scpiErrorString(int code) {
+  switch (code) {
+    case SCPI_ERR_NONE: return "No error";
+    case SCPI_ERR_COMMAND: return "Command error";
+    case SCPI_ERR_DATA_TYPE: return "Data type error";
+    case SCPI_ERR_MISSING_PARAMETER: return "Missing parameter";
+    case SCPI_ERR_UNDEFINED_HEADER: return "Undefined header";
+    case SCPI_ERR_EXECUTION: return "Execution error";
+    case SCPI_ERR_DATA_OUT_OF_RANGE: return "Data out of range";
+    case SCPI_ERR_QUEUE_OVERFLOW: return "Queue overflow";
+    case SCPI_ERR_INPUT_BUFFER_OVERRUN: return "Input buffer overrun";
+    default: return "Unknown error";
+  }
+}
+
+// Fixed-size FIFO of pending errors, drained by SYSTem:ERRor?.
+class ScpiErrorQueue {
+public:
+  void push(int code) {
+    if (count == SCPI_ERROR_QUEUE_LEN) {
+      // Per SCPI, the most recent entry is replaced by a queue overflow.
+      codes[(head + count - 1) % SCPI_ERROR_QUEUE_LEN] = SCPI_ERR_QUEUE_OVERFLOW;
+      return;
+    }
+    codes[(head + count) % SCPI_ERROR_QUEUE_LEN] = code;
+    count++;
+  }
+
+  int pop() {
+    if (count == 0) return SCPI_ERR_NONE;
+    int code = codes[head];
+    head = (head + 1) % SCPI_ERROR_QUEUE_LEN;
+    count--;
+    return code;
+  }
+
+private:
+  int codes[SCPI_ERROR_QUEUE_LEN];
+  uint8_t head = 0;
+  uint8_t count = 0;
+};
+
+struct ScpiContext {
+  Print &out;
+  ScpiErrorQueue &errors;
+  char *params; // Parameter text following the header, may be empty.
+
+  // Parses the next comma-separated numeric parameter. On failure the
+  // appropriate SCPI error is queued and false is returned.
+  bool nextDouble(double &value) {
+    while (*params == ' ' || *params == '\t') params++;
+    if (*params == '\0') {
+      errors.push(SCPI_ERR_MISSING_PARAMETER);
+      return false;
+    }
+    char *end;
+    value = strtod(params, &end);
+    if (end == params) {
+      errors.push(SCPI_ERR_DATA_TYPE);
+      return false;
+    }
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end == ',') end++;
+    params = end;
+    return true;
+  }
+
+  // Parses a boolean parameter: ON/OFF or 1/0, as a whole token.
+  bool nextBool(bool &value) {
+    while (*params == ' ' || *params == '\t') params++;
+    if (*params == '\0') {
+      errors.push(SCPI_ERR_MISSING_PARAMETER);
+      return false;
+    }
+    size_t len = 0;
+    while (params[len] && params[len] != ',' && params[len] != ' ' && params[len] != '\t') len++;
+    if ((len == 2 && strncasecmp(params, "ON", 2) == 0) || (len == 1 && *params == '1')) {
+      value = true;
+    } else if ((len == 3 && strncasecmp(params, "OFF", 3) == 0) || (len == 1 && *params == '0')) {
+      value = false;
+    } else {
+      errors.push(SCPI_ERR_DATA_TYPE);
+      return false;
+    }
+    char *end = params + len;
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end == ',') end++;
+    params = end;
+    return true;
+  }
+
+  void error(int code) { errors.push(code); }
+};
+
+// Matches one header keyword (up to ':' / '?' / end) against its pattern.
+// The pattern's upper-case prefix is the mandatory short form.
+bool scpiMatchKeyword(const char *&pat, const char *&in) {
+  const char *p = pat;
+  const char *s = in;
+  size_t shortLen = 0;
+  while (p[shortLen] && p[shortLen] != ':' && p[shortLen] != '?' &&
+         !(p[shortLen] >= 'a' && p[shortLen] <= 'z')) {
+    shortLen++;
+  }
+  size_t patLen = shortLen;
+  while (p[patLen] && p[patLen] != ':' && p[patLen] != '?') patLen++;
+
+  size_t inLen = 0;
+  while (s[inLen] && s[inLen] != ':' && s[inLen] != '?') inLen++;
+
+  if (inLen != shortLen && inLen != patLen) return false;
+  for (size_t i = 0; i < inLen; i++) {
+    if (toupper((unsigned char)s[i]) != toupper((unsigned char)p[i])) return false;
+  }
+  pat = p + patLen;
+  in = s + inLen;
+  return true;
+}
+
+bool scpiMatchHeader(const char *pattern, const char *header) {
+  const char *p = pattern;
+  const char *h = header;
+  if (*h == ':') h++;
+  while (true) {
+    if (*p == '\0' || *h == '\0') return *p == *h;
+    if (*p == ':' || *p == '?') {
+      if (*p != *h) return false;
+      p++;
+      h++;
+      continue;
+    }
+    if (!scpiMatchKeyword(p, h)) return false;
+  }
+}
+
+// Line-oriented session bound to one input stream. Feed bytes in as they
+// arrive; each complete line is dispatched against the command table.
+class ScpiSession {
+public:
+  ScpiSession(const ScpiCommand *commands, size_t commandCount)
+      : commands(commands), commandCount(commandCount) {}
+
+  void feed(char c, Print &out) {
+    if (c == '\r') return;
+    if (c == '\n') {
+      if (overrun) {
+        errors.push(SCPI_ERR_INPUT_BUFFER_OVERRUN);
+      } else {
+        line[length] = '\0';
+        execute(out);
+      }
+      length = 0;
+      overrun = false;
+      return;
+    }
+    if (length < SCPI_MAX_LINE - 1) {
+      line[length++] = c;
+    } else {
+      overrun = true;
+    }
+  }
+
+  // Consumes at most maxBytes from the stream so a chatty client cannot
+  // starve the control loop.
+  void poll(Stream &io, size_t maxBytes) {
+    while (maxBytes-- > 0 && io.available() > 0) {
+      feed((char)io.read(), io);
+    }
+  }
+
+  void reset() {
+    length = 0;
+    overrun = false;
+  }
+
+  ScpiErrorQueue errors;
+
+private:
+  void execute(Print &out) {
+    // Several commands may be chained on one line with ';'.
+    char *cursor = line;
+    while (cursor != nullptr) {
+      char *next = strchr(cursor, ';');
+      if (next != nullptr) *next++ = '\0';
+      executeOne(cursor, out);
+      cursor = next;
+    }
+  }
+
+  void executeOne(char *text, Print &out) {
+    while (*text == ' ' || *text == '\t') text++;
+    if (*text == '\0') return;
+
+    char *params = text;
+    while (*params && *params != ' ' && *params != '\t') params++;
+    if (*params != '\0') *params++ = '\0';
+
+    for (size_t i = 0; i < commandCount; i++) {
+      if (scpiMatchHeader(commands[i].pattern, text)) {
+        ScpiContext ctx{out, errors, params};
+        commands[i].handler(ctx);
+        return;
+      }
+    }
+    errors.push(SCPI_ERR_UNDEFINED_HEADER);
+  }
+
+  const ScpiCommand *commands;
+  size_t commandCount;
+  char line[SCPI_MAX_LINE];
+  size_t length = 0;
+  bool overrun = false;
+};
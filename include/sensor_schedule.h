@@ -0,0 +1,62 @@
+#pragma once
+
+// sensor_schedule.h
+//
+// Multi-rate INA219 sampling. The shunt current is read on every control
+// tick; the bus voltage changes slowly and is only needed for the
+// compliance check and telemetry, so it is read every Nth tick. Skipping
+// it halves the I2C traffic per tick.
+//
+// The compliance check must not get weaker because of this. Each voltage
+// reading is extrapolated over the next decimation interval from the slope
+// between the last two readings. If that estimate could come within the
+// margin of the limit, the voltage is read on every tick again until it
+// is comfortably clear.
+
+#include <stdint.h>
+
+class SensorSchedule {
+public:
+  void begin(uint8_t decimation, float limit_V, float margin_V) {
+    this->decimation = decimation < 1 ? 1 : decimation;
+    this->limit_V = limit_V;
+    this->margin_V = margin_V;
+    hasVoltage = false;
+    ticksSinceVoltage = 0;
+  }
+
+  // Called once per current sample. True when the bus voltage should be
+  // read with it.
+  bool voltageDue() {
+    ticksSinceVoltage++;
+    return !hasVoltage || fullRate || ticksSinceVoltage >= decimation;
+  }
+
+  void voltageRead(float voltage_V) {
+    if (hasVoltage && ticksSinceVoltage > 0) slope_VPerTick = (voltage_V - lastVoltage_V) / ticksSinceVoltage;
+    lastVoltage_V = voltage_V;
+    ticksSinceVoltage = 0;
+    hasVoltage = true;
+
+    float rising = slope_VPerTick > 0 ? slope_VPerTick : 0;
+    bool wasFullRate = fullRate;
+    fullRate = voltage_V + rising * decimation >= limit_V - margin_V;
+    if (fullRate && !wasFullRate) fullRateEntries++;
+  }
+
+  bool isFullRate() const { return fullRate; }
+  float getSlope_VPerTick() const { return slope_VPerTick; }
+  // Times the guard switched voltage reads to every tick.
+  uint32_t getFullRateEntries() const { return fullRateEntries; }
+
+private:
+  uint8_t decimation = 1;
+  float limit_V = 0;
+  float margin_V = 0;
+  bool hasVoltage = false;
+  bool fullRate = false;
+  uint32_t ticksSinceVoltage = 0;
+  float lastVoltage_V = 0;
+  float slope_VPerTick = 0;
+  uint32_t fullRateEntries = 0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+// seqlock.h
+//
+// Single-writer sequence lock for publishing a small POD block to a reader
+// running on another core or in an ISR. The writer never blocks; the reader
+// makes a bounded number of attempts and reports failure instead of
+// spinning, so it is wait-free and can simply keep its previous copy.
+//
+// Only plain atomic loads and stores are used (no read-modify-write), so
+// this also works on the ESP8266, which lacks 32-bit atomic RMW support.
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#define SEQLOCK_READ_ATTEMPTS 4
+
+template <typename T>
+class SeqLock {
+public:
+  // Must only be called from one context at a time. Several writers have
+  // to serialize around it themselves, e.g. with a mutex: two overlapping
+  // writes can leave seq even over a mix of both blocks. In this firmware
+  // each block has a single writer, the control step or its owning task.
+  void write(const T &value) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed); // Odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    copyIn(value);
+    std::atomic_thread_fence(std::memory_order_release);
+    seq.store(s + 2, std::memory_order_relaxed);
+  }
+
+  // Copies a consistent snapshot into out. Returns false, leaving out
+  // untouched, if every attempt overlapped a write. If readVersion is
+  // given it receives the version() of the snapshot. Always inlined so an
+  // IRAM-resident reader does not call back into flash.
+  inline __attribute__((always_inline)) bool tryRead(T &out, uint32_t *readVersion = nullptr) const {
+    for (uint8_t attempt = 0; attempt < SEQLOCK_READ_ATTEMPTS; attempt++) {
+      uint32_t before = seq.load(std::memory_order_acquire);
+      if (before & 1) continue;
+      T copy;
+      copyOut(copy);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq.load(std::memory_order_relaxed) == before) {
+        out = copy;
+        if (readVersion != nullptr) *readVersion = before;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Even number that advances by 2 per completed write.
+  uint32_t version() const { return seq.load(std::memory_order_acquire); }
+
+private:
+  // Byte-wise volatile copies keep the compiler from caching or tearing
+  // the block across the fences.
+  void copyIn(const T &value) {
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(&value);
+    volatile uint8_t *dst = reinterpret_cast<volatile uint8_t *>(&data);
+    for (size_t i = 0; i < sizeof(T); i++) dst[i] = src[i];
+  }
+
+  inline __attribute__((always_inline)) void copyOut(T &value) const {
+    const volatile uint8_t *src = reinterpret_cast<const volatile uint8_t *>(&data);
+    uint8_t *dst = reinterpret_cast<uint8_t *>(&value);
+    for (size_t i = 0; i < sizeof(T); i++) dst[i] = src[i];
+  }
+
+  std::atomic<uint32_t> seq{0};
+  T data{};
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+// telemetry_frame.h
+//
+// Wire formats for the binary telemetry stream and the binary /data
+// snapshot. This header has no Arduino
+// dependencies so the host-side decoder in tools/ can include it directly.
+//
+// Frame layout before encoding (all fields little-endian):
+//
+//   TelemetryFrameHeader | TelemetrySample x count | CRC-16/CCITT-FALSE
+//
+// On byte streams (UART) each frame is COBS-encoded and terminated with a
+// single 0x00 byte, so a receiver can resynchronise on any zero byte and
+// drop anything that fails the CRC (e.g. interleaved SCPI text replies).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TELEMETRY_FRAME_VERSION 1
+#define TELEMETRY_FRAME_SAMPLES 1 // Frame type: batch of TelemetrySample
+
+// Sample flag bits.
+#define TELEMETRY_FLAG_SAFETY_OVERRIDE 0x01
+#define TELEMETRY_FLAG_COMPLIANCE_CAP 0x02 // Output capped by the predictive guard
+#define TELEMETRY_FLAG_LOAD_FAULT 0x04 // Open/short-circuit fault latched
+#define TELEMETRY_FLAG_ALARM 0x08 // One or more alarm rules latched
+#define TELEMETRY_FLAG_WATCHDOG 0x10 // First sample after a watchdog trip
+#define TELEMETRY_FLAG_SENSOR_FAULT 0x20 // INA219 lost; output held while it is recovered
+
+struct __attribute__((packed)) TelemetryFrameHeader {
+  uint8_t version;
+  uint8_t type;
+  uint8_t count;   // Number of samples that follow
+  uint8_t reserved;
+};
+
+struct __attribute__((packed)) TelemetrySample {
+  uint32_t seq;          // Control sample sequence number
+  uint32_t timestamp_us; // micros() at acquisition
+  float current_mA;
+  float voltage_V;
+  float setpoint_mA;
+  uint8_t output;        // Code written to the DAC/PWM output
+  uint8_t flags;         // TELEMETRY_FLAG_*
+};
+
+// Packed little-endian body of /data when the client sends
+// "Accept: application/octet-stream".
+#define DATA_SNAPSHOT_VERSION 1
+
+struct __attribute__((packed)) DataSnapshot {
+  uint8_t version;
+  uint8_t flags;  // TELEMETRY_FLAG_* of the latest sample
+  uint16_t reserved;
+  uint32_t seq;   // Control sample sequence number
+  float voltage_V;
+  float current_mA;
+  float setpoint_mA;
+  float kp;
+  float ki;
+  float kd;
+  float maxLimit_mA;
+};
+
+// Appended to the binary /data body when the request carries agg=1:
+// statistics over the control samples since the client's last request.
+struct __attribute__((packed)) DataAggregate {
+  uint32_t count;
+  float currentMin_mA;
+  float currentMax_mA;
+  float currentMean_mA;
+  float voltageMin_V;
+  float voltageMax_V;
+  float voltageMean_V;
+};
+
+// Largest raw (unencoded) frame for a given sample count.
+#define TELEMETRY_FRAME_SIZE(n) \
+  (sizeof(TelemetryFrameHeader) + (n) * sizeof(TelemetrySample) + 2)
+
+// Worst-case COBS output for len input bytes, excluding the delimiter.
+#define COBS_MAX_ENCODED_SIZE(len) ((len) + ((len) / 254) + 1)
+
+inline uint16_t crc16Ccitt(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF) {
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Builds a raw frame into out (at least TELEMETRY_FRAME_SIZE(count) bytes).
+// Returns the number of bytes written.
+inline size_t telemetryBuildFrame(const TelemetrySample *samples, uint8_t count, uint8_t *out) {
+  TelemetryFrameHeader header = {TELEMETRY_FRAME_VERSION, TELEMETRY_FRAME_SAMPLES, count, 0};
+  size_t len = 0;
+  memcpy(out, &header, sizeof(header));
+  len += sizeof(header);
+  memcpy(out + len, samples, count * sizeof(TelemetrySample));
+  len += count * sizeof(TelemetrySample);
+  uint16_t crc = crc16Ccitt(out, len);
+  out[len++] = (uint8_t)(crc & 0xFF);
+  out[len++] = (uint8_t)(crc >> 8);
+  return len;
+}
+
+// Validates a raw frame. On success points samples at the payload and
+// returns the sample count; returns -1 on a malformed frame or CRC error.
+inline int telemetryParseFrame(const uint8_t *frame, size_t len, const TelemetrySample **samples) {
+  if (len < TELEMETRY_FRAME_SIZE(0)) return -1;
+  uint16_t crc = (uint16_t)(frame[len - 2] | (frame[len - 1] << 8));
+  if (crc16Ccitt(frame, len - 2) != crc) return -1;
+  TelemetryFrameHeader header;
+  memcpy(&header, frame, sizeof(header));
+  if (header.version != TELEMETRY_FRAME_VERSION || header.type != TELEMETRY_FRAME_SAMPLES) return -1;
+  if (len != TELEMETRY_FRAME_SIZE(header.count)) return -1;
+  *samples = reinterpret_cast<const TelemetrySample *>(frame + sizeof(header));
+  return header.count;
+}
+
+// Consistent Overhead Byte Stuffing. The output contains no 0x00 bytes;
+// the caller appends the 0x00 delimiter. Returns the encoded length.
+inline size_t cobsEncode(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t codeIndex = 0;
+  size_t outIndex = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < len; i++) {
+    if (in[i] != 0) {
+      out[outIndex++] = in[i];
+      code++;
+    }
+    if (in[i] == 0 || code == 0xFF) {
+      out[codeIndex] = code;
+      code = 1;
+      codeIndex = outIndex++;
+    }
+  }
+  out[codeIndex] = code;
+  return outIndex;
+}
+
+// Decodes one COBS block (without delimiter) in place-safe fashion.
+// Returns the decoded length, or 0 if the block is malformed.
+inline size_t cobsDecode(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t inIndex = 0;
+  size_t outIndex = 0;
+  while (inIndex < len) {
+    uint8_t code = in[inIndex++];
+    if (code == 0 || inIndex + code - 1 > len) return 0;
+    for (uint8_t i = 1; i < code; i++) out[outIndex++] = in[inIndex++];
+    if (code != 0xFF && inIndex < len) out[outIndex++] = 0;
+  }
+  return outIndex;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+// udp_telemetry.h
+//
+// Optional UDP multicast telemetry. Control samples are decimated, batched
+// into a single TelemetryFrame (see telemetry_frame.h) and sent as one
+// datagram, so the device cost is independent of the number of listeners.
+// Datagrams carry the raw frame with its CRC; no COBS encoding is needed.
+//
+// The control step only builds the frame. send() hands it to lwIP from
+// the web slice of loop(), since a send can take far longer than a control
+// period. Both run on the loop task. A frame that is still waiting when the
+// next batch completes is replaced and counted as a send error.
+
+#ifdef ESP8266
+  #include <ESP8266WiFi.h>
+#else
+  #include <WiFi.h>
+#endif
+#include <WiFiUdp.h>
+#include "telemetry_frame.h"
+
+#define UDP_TELEMETRY_MAX_BATCH 32
+
+class UdpTelemetry {
+public:
+  void begin(const IPAddress &group, uint16_t port) {
+    this->group = group;
+    this->port = port;
+    batchCount = 0;
+    decimationCounter = 0;
+  }
+
+  // Every decimation-th sample is kept; a datagram is sent every batchSize
+  // kept samples. The datagram rate is control rate / (decimation * batch).
+  void configure(uint16_t decimation, uint8_t batchSize) {
+    this->decimation = decimation < 1 ? 1 : decimation;
+    this->batchSize = constrain(batchSize, (uint8_t)1, (uint8_t)UDP_TELEMETRY_MAX_BATCH);
+    batchCount = 0;
+  }
+
+  void setEnabled(bool enable) {
+    enabled = enable;
+    batchCount = 0;
+    pendingLength = 0;
+  }
+
+  bool isEnabled() const { return enabled; }
+  uint16_t getDecimation() const { return decimation; }
+  uint8_t getBatchSize() const { return batchSize; }
+  uint32_t getDatagramsSent() const { return datagramsSent; }
+  uint32_t getSendErrors() const { return sendErrors; }
+
+  void push(const TelemetrySample &sample) {
+    if (!enabled) return;
+    if (++decimationCounter < decimation) return;
+    decimationCounter = 0;
+
+    batch[batchCount++] = sample;
+    if (batchCount >= batchSize) seal();
+  }
+
+  // Frames the samples batched so far for the next send().
+  void seal() {
+    if (batchCount == 0) return;
+    if (pendingLength != 0) sendErrors++;
+    pendingLength = telemetryBuildFrame(batch, batchCount, pending);
+    batchCount = 0;
+  }
+
+  // Sends the sealed frame, if any. Not for the control step.
+  void send() {
+    if (pendingLength == 0) return;
+    size_t len = pendingLength;
+    pendingLength = 0;
+
+    if (WiFi.status() != WL_CONNECTED) {
+      sendErrors++;
+      return;
+    }
+    #ifdef ESP8266
+      int ok = udp.beginPacketMulticast(group, port, WiFi.localIP());
+    #else
+      int ok = udp.beginPacket(group, port);
+    #endif
+    if (ok) {
+      udp.write(pending, len);
+      ok = udp.endPacket();
+    }
+    if (ok) datagramsSent++; else sendErrors++;
+  }
+
+private:
+  WiFiUDP udp;
+  IPAddress group;
+  uint16_t port = 0;
+  bool enabled = false;
+  uint16_t decimation = 1;
+  uint16_t decimationCounter = 0;
+  uint8_t batchSize = 1;
+  uint8_t batchCount = 0;
+  TelemetrySample batch[UDP_TELEMETRY_MAX_BATCH];
+  uint8_t pending[TELEMETRY_FRAME_SIZE(UDP_TELEMETRY_MAX_BATCH)];
+  size_t pendingLength = 0; // 0 when nothing is waiting for send()
+  uint32_t datagramsSent = 0;
+  uint32_t sendErrors = 0;
+};
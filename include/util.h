@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 
 #ifdef ESP8266
@@ -22,106 +22,1413 @@
 #include <WiFiManager.h>
 #include <Wire.h>
 #include <INA219.h>
-#include <PID_v1.h>
 #include "config.h"
+#include "alarms.h"
+#include "async_i2c.h"
+#include "cbor.h"
+#include "client_aggregates.h"
+#include "command_queue.h"
+#include "compliance_guard.h"
+#include "control_watchdog.h"
+#include "delta_publisher.h"
+#include "event_log.h"
+#include "fast_control.h"
+#include "flight_recorder.h"
+#include "float_pid.h"
 #include "index.h"
+#include "ina219_link.h"
+#include "ina219_registers.h"
+#include "load_faults.h"
+#include "mailbox.h"
+#include "output_stage.h"
+#include "payload_cache.h"
+#include "recovery_tracker.h"
+#include "scheduler.h"
+#include "scpi.h"
+#include "seqlock.h"
+#include "sensor_schedule.h"
+#include "telemetry_frame.h"
+#include "udp_telemetry.h"
 #include "util.h"
 
 
 // --- INA219 Sensor ---
 INA219 ina219(INA219_ADDRESS);
+Ina219Link sensorLink(ina219, Wire); // Error counting and bus recovery for the Wire paths
+bool sensorWasDegraded = false;
 
 // --- PID Controller ---
-double Setpoint, Input, Output;
-double Kp = DEFAULT_KP, Ki = DEFAULT_KI, Kd = DEFAULT_KD;
-PID myPID(&Input, &Output, &Setpoint, Kp, Ki, Kd, DIRECT);
+// BasicPID<double> is PID_v1's arithmetic with ComputeAt(), so the control
+// step can run it on its own clock instead of millis().
+#if CONTROL_FLOAT_PID
+  float Setpoint, Input, Output;
+  FloatPID myPID(&Input, &Output, &Setpoint, DEFAULT_KP, DEFAULT_KI, DEFAULT_KD, DIRECT);
+#else
+  double Setpoint, Input, Output;
+  BasicPID<double> myPID(&Input, &Output, &Setpoint, DEFAULT_KP, DEFAULT_KI, DEFAULT_KD, DIRECT);
+#endif
+static_assert(FAST_CONTROL || CONTROL_PERIOD_US % 1000 == 0, "The PID's sample time is in whole milliseconds");
+#define PID_SAMPLE_TIME_MS (CONTROL_PERIOD_US / 1000)
+// Advances by exactly one sample time per control step, so every step's
+// ComputeAt() runs however the step's start jitters against millis().
+unsigned long pidClock_ms = 0;
 
 // --- Web Server ---
-WebServer server(80);
+// Exposes whether another client is waiting so a parked long-poll can give
+// the server back instead of holding everyone else up.
+class ControllerWebServer : public WebServer {
+public:
+  using WebServer::WebServer;
+  bool hasPendingClient() { return _server.hasClient(); }
+};
+
+ControllerWebServer server(80);
+
+// --- SCPI Interface (Serial and raw TCP) ---
+WiFiServer scpiServer(SCPI_TCP_PORT);
+WiFiClient scpiClient;
 
 // --- Global Variables ---
 float busVoltage_V = 0;
 float current_mA = 0;
-double targetCurrent_mA = 100.0;
-double maxCurrentLimit_mA = 500.0;
+SensorSchedule sensorSchedule; // Current every tick, voltage every Nth
+OutputStage outputStage(DAC_PIN);
+RecoveryTracker complianceRecovery(RECOVERY_BAND_MA);
+ComplianceGuard complianceGuard; // dV/dt prediction ahead of the hard limit
+bool complianceCapped = false;
+uint32_t complianceCaps = 0;
+LoadFaultDetector loadFaults; // Owned by the control step
+const AlarmRule alarmRules[] = {ALARM_RULES};
+AlarmEngine alarms; // Owned by the control step
+
+// --- Control Parameters ---
+// Owned by the control step. HTTP and SCPI handlers never write them; they
+// post ControlCommands, which the control step applies at the start of a
+// tick and then republishes through paramBlock for the handlers to read.
+struct ControlParams {
+  double targetCurrent_mA;
+  double maxCurrentLimit_mA;
+  double kp;
+  double ki;
+  double kd;
+};
+
+ControlParams activeParams = {DEFAULT_TARGET_CURRENT_MA, DEFAULT_MAX_CURRENT_MA, DEFAULT_KP, DEFAULT_KI, DEFAULT_KD};
+SeqLock<ControlParams> paramBlock;
+
+// --- Command Queue ---
+enum ControlCommandType : uint8_t {
+  CMD_SET_CURRENT,       // a = target mA
+  CMD_SET_PID,           // a, b, c = Kp, Ki, Kd
+  CMD_SET_MAX_LIMIT,     // a = limit mA
+  CMD_SET_DEADBAND,      // a = mA, b = V
+  CMD_SET_SERIAL_STREAM, // a = enable
+  CMD_SET_UDP_STREAM,    // a = enable, b = decimation, c = batch size
+  CMD_CLEAR_LOAD_FAULT,
+  CMD_CLEAR_ALARMS,
+#if I2C_FAULT_INJECTION
+  CMD_INJECT_I2C_FAULTS, // a = number of reads to fail
+#endif
+};
+
+struct ControlCommand {
+  ControlCommandType type;
+  uint32_t arrival_us;
+  double a, b, c;
+};
+
+MpscQueue<ControlCommand, COMMAND_QUEUE_DEPTH> commandQueue;
+// Arrival to the first tick that writes an output with the command applied.
+ActuationLatency<COMMAND_QUEUE_DEPTH> commandLatency;
+uint32_t commandsRejected = 0;
+
+// --- Telemetry ---
+TelemetrySample lastSample;
+uint32_t sampleSeq = 0;
+bool serialStreamEnabled = SERIAL_STREAM_ON_BOOT;
+uint32_t serialStreamDropped = 0;
+UdpTelemetry udpTelemetry;
+
+// --- /data Response Cache ---
+// Longest %.2f of a float, "-340282346638528859811704183484516925440.00".
+// JSON fields are narrowed to float before formatting so this bound holds.
+#define JSON_FLOAT_CHARS 43
+PayloadCache<80 + 7 * JSON_FLOAT_CHARS> jsonSnapshot('j');
+PayloadCache<sizeof(DataSnapshot)> binarySnapshot('b');
+PayloadCache<128> cborSnapshot('c');
+
+// --- /data Long-Poll ---
+DeltaPublisher deltaPublisher;
+
+// --- /data Per-Client Aggregation ---
+ClientAggregator clientAggregator;
+
+// --- Event Log ---
+// Appended from the loop task only: the control step, command handling,
+// fast path housekeeping and the WiFi watch.
+EventLog<EVENT_LOG_CAPACITY> eventLog;
+bool safetyEpisode = false; // From the first override until regulation is back
+
+// --- Flight Recorder ---
+// Samples and events also go to reset-surviving memory; the previous run's
+// record is served at /flight.
+#if FLIGHT_RECORDER
+typedef FlightRecorder<FLIGHT_RECORDER_SAMPLES, FLIGHT_RECORDER_EVENTS> ControllerFlightRecorder;
+#ifndef ESP8266
+RTC_NOINIT_ATTR ControllerFlightRecorder::Log flightMemory;
+#endif
+ControllerFlightRecorder flightRecorder;
+#endif
+
+void logEvent(EventType type, uint8_t code = 0, float a = 0, float b = 0, float c = 0) {
+  const EventRecord &event = eventLog.append(millis(), type, code, a, b, c);
+#if FLIGHT_RECORDER
+  flightRecorder.recordEvent(event);
+#else
+  (void)event;
+#endif
+}
+
+// One trip/clear pair per episode, from the first override to the tick the
+// current is back within RECOVERY_BAND_MA, so an override that chatters at
+// the voltage limit does not flood the log. Call after complianceRecovery.
+void logSafetyEpisode(bool overridden, float voltage_V, float measured_mA, float setpoint_mA) {
+  if (overridden && !safetyEpisode) {
+    safetyEpisode = true;
+    logEvent(EVENT_SAFETY_TRIP, 0, voltage_V, measured_mA, setpoint_mA);
+  } else if (safetyEpisode && !overridden && !complianceRecovery.isRecovering()) {
+    safetyEpisode = false;
+    logEvent(EVENT_SAFETY_CLEAR, 0, voltage_V, measured_mA, setpoint_mA);
+  }
+}
+
+// Folds I2C errors into at most one event per EVENT_I2C_INTERVAL_MS, so a
+// stuck bus does not push everything else out of the log.
+void logI2cErrors(uint32_t totalErrors) {
+  static uint32_t logged = 0;
+  static uint32_t lastEvent_ms = 0;
+  uint32_t now_ms = millis();
+  if (totalErrors == logged || (logged != 0 && now_ms - lastEvent_ms < EVENT_I2C_INTERVAL_MS)) return;
+  logEvent(EVENT_I2C_ERROR, 0, totalErrors - logged, totalErrors);
+  logged = totalErrors;
+  lastEvent_ms = now_ms;
+}
+
+// Logs the rules that latched on this sample and drives ALARM_GPIO_PIN.
+// Returns the telemetry flag bit, which carries alarms on the push streams.
+uint8_t notifyAlarms(uint32_t raised) {
+  for (uint8_t i = 0; raised != 0; i++, raised >>= 1) {
+    if (raised & 1) logEvent(EVENT_ALARM, i, alarms.getTripValue(i), alarms.getRule(i).threshold);
+  }
+  bool active = alarms.getLatched() != 0;
+#if ALARM_GPIO_PIN >= 0
+  static bool pinActive = false;
+  if (active != pinActive) {
+    digitalWrite(ALARM_GPIO_PIN, active ? HIGH : LOW);
+    pinActive = active;
+  }
+#endif
+  return active ? TELEMETRY_FLAG_ALARM : 0;
+}
+
+void logWifiChanges() {
+  static bool connected = true; // setup() does not return without a connection
+  wl_status_t status = WiFi.status();
+  if ((status == WL_CONNECTED) == connected) return;
+  connected = status == WL_CONNECTED;
+  if (connected) logEvent(EVENT_WIFI_UP, 0, WiFi.RSSI());
+  else logEvent(EVENT_WIFI_DOWN, status);
+}
+
+// --- Scheduler ---
+CooperativeScheduler scheduler;
+
+// --- Fast Control Path (timer ISR on ESP8266) ---
+#if FAST_CONTROL
+FastControlLoop fastControl;
+uint32_t fastParamsVersion = 0;
+#endif
+
+// --- Control Watchdog ---
+// With CONTROL_TIMER_ISR the control step already runs from timer0, which
+// the watchdog would need, and does not stall with loop().
+#if CONTROL_WATCHDOG && !FAST_CONTROL
+  #define WATCHDOG_SUPERVISOR 1
+#else
+  #define WATCHDOG_SUPERVISOR 0
+#endif
+
+#if WATCHDOG_SUPERVISOR
+ControlWatchdog controlWatchdog;
+#endif
+
+// --- Dual-Core Acquisition Pipeline (ESP32) ---
+// A task on core 0 reads the INA219 while the control step on core 1 runs
+// the PID and writes the DAC for the previous sample. Taking a sample from
+// the mailbox releases the task to start the next read, so bus transfer
+// and compute overlap instead of alternating.
+#if !defined(ESP8266) && CONTROL_DUAL_CORE
+  #define DUAL_CORE_ACQUISITION 1
+#else
+  #define DUAL_CORE_ACQUISITION 0
+#endif
+
+#if DUAL_CORE_ACQUISITION
+struct AcquiredSample {
+  uint32_t timestamp_us;
+  bool voltageFresh; // voltage_V was read with this sample
+  float voltage_V;
+  float current_mA;
+};
+
+Mailbox<AcquiredSample> acquisitionMailbox;
+SeqLock<double> acquisitionLimit_mA; // Calibration is applied by the task
+TaskHandle_t acquisitionTaskHandle = nullptr;
+uint32_t staleControlTicks = 0; // Ticks that found no new sample
+
+void acquisitionTask(void *) {
+  uint32_t limitVersion = acquisitionLimit_mA.version();
+  double limit_mA = activeParams.maxCurrentLimit_mA; // Set in setup() before this task starts
+  float voltage_V = 0; // Latest bus voltage; read every few samples
+  for (;;) {
+    // The INA219 object and sensorLink are only touched from this task once it runs.
+    if (acquisitionLimit_mA.version() != limitVersion) {
+      if (acquisitionLimit_mA.tryRead(limit_mA, &limitVersion)) {
+        ina219.setMaxCurrentShunt(limit_mA / 1000.0, SHUNT_RESISTOR_OHMS);
+      }
+    }
+    // No sample is posted while degraded or after a failed read, so the
+    // control step sees stale ticks and, once degraded, holds the output.
+    if (sensorLink.isDegraded()) {
+      sensorLink.service(limit_mA);
+      ulTaskNotifyTake(pdTRUE, 1); // service() paces the attempts
+      continue;
+    }
+    AcquiredSample sample;
+    sample.timestamp_us = micros();
+    if (!sensorLink.readCurrent(sample.current_mA)) {
+      ulTaskNotifyTake(pdTRUE, 1);
+      continue;
+    }
+    // sensorSchedule belongs to this task
+    sample.voltageFresh = sensorSchedule.voltageDue() && sensorLink.readBusVoltage(voltage_V);
+    if (sample.voltageFresh) sensorSchedule.voltageRead(voltage_V);
+    sample.voltage_V = voltage_V;
+    acquisitionMailbox.post(sample);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100)); // Woken when the sample is taken
+  }
+}
+#endif
+
+// --- Asynchronous Acquisition (ESP32) ---
+// The control step collects the register reads started at the end of the
+// previous tick and starts the next pair, so the bus transfer overlaps
+// everything loop() does in between instead of blocking the step.
+#if !defined(ESP8266) && CONTROL_ASYNC_I2C && !DUAL_CORE_ACQUISITION
+  #define ASYNC_ACQUISITION 1
+#else
+  #define ASYNC_ACQUISITION 0
+#endif
+
+#if ASYNC_ACQUISITION
+AsyncI2c asyncI2c;
+AsyncI2cRead currentRead(INA219_ADDRESS, INA219_REG_CURRENT);
+AsyncI2cRead voltageRead(INA219_ADDRESS, INA219_REG_BUS_VOLTAGE);
+float currentReadLsb_mA = 0; // Calibration the pending current read was started under
+uint32_t currentReadStart_us = 0;
+uint32_t staleControlTicks = 0; // Ticks whose reads had not completed
+
+// Collects finished reads into busVoltage_V / current_mA, then starts the
+// next current read, plus a voltage read when sensorSchedule wants one.
+// Returns true if a fresh current reading was collected.
+bool collectAsyncSample(uint32_t &timestamp_us) {
+  if (currentRead.isPending() || voltageRead.isPending()) {
+    staleControlTicks++;
+    return false;
+  }
+  bool fresh = currentRead.status == ASYNC_I2C_DONE;
+  if (currentRead.status != ASYNC_I2C_IDLE) fresh = sensorLink.report(fresh, currentRead.error);
+  if (fresh) {
+    current_mA = (int16_t)currentRead.value * currentReadLsb_mA;
+    timestamp_us = currentReadStart_us;
+  }
+  if (voltageRead.status != ASYNC_I2C_IDLE &&
+      sensorLink.report(voltageRead.status == ASYNC_I2C_DONE, voltageRead.error)) {
+    busVoltage_V = INA219_BUS_VOLTAGE_V(voltageRead.value);
+    sensorSchedule.voltageRead(busVoltage_V);
+    complianceGuard.addVoltage(currentReadStart_us, busVoltage_V);
+  }
+  currentRead.status = ASYNC_I2C_IDLE;
+  voltageRead.status = ASYNC_I2C_IDLE;
+  if (sensorLink.isDegraded()) {
+    sensorLink.service(activeParams.maxCurrentLimit_mA); // Nothing is in flight, so the bus is free
+    return false;
+  }
+
+  currentReadLsb_mA = ina219.getCurrentLSB_mA();
+  currentReadStart_us = micros();
+  asyncI2c.startRead(currentRead);
+  if (sensorSchedule.voltageDue()) asyncI2c.startRead(voltageRead);
+  return fresh;
+}
+#endif
+
+// --- Forward Declarations ---
+void controlStep();
+void handleScpi();
+
+// Runs the control step if it is due. Called from loop() and from any web
+// handler that would otherwise hold the CPU for longer than a period. On
+// the fast path this drives fastControl instead (see fast_control.h).
+void serviceControl() {
+#if FAST_CONTROL
+  void fastControlHousekeeping();
+  scheduler.runControlIfDue(fastControlHousekeeping);
+#else
+  scheduler.runControlIfDue(controlStep);
+#endif
+}
+
+
+// --- Shared Setters (used by both HTTP and SCPI) ---
+// Each setter posts a command for the control step and returns false if
+// the queue is full.
+bool postCommand(ControlCommandType type, double a = 0, double b = 0, double c = 0) {
+  ControlCommand command = {type, (uint32_t)micros(), a, b, c};
+  if (commandQueue.push(command)) return true;
+  commandsRejected++;
+  return false;
+}
+
+// Range check shared by /set and SOURce:CURRent; the limit is applied by
+// the control step. Written so NaN fails too.
+bool validTargetCurrent(double requested_mA) { return requested_mA >= 0; }
+
+bool applyTargetCurrent(double requested_mA) { return postCommand(CMD_SET_CURRENT, requested_mA); }
+bool applyPidTunings(double kp, double ki, double kd) { return postCommand(CMD_SET_PID, kp, ki, kd); }
+bool applyMaxCurrentLimit(double limit_mA) { return postCommand(CMD_SET_MAX_LIMIT, limit_mA); }
+
+#if FAST_CONTROL
+// Hands the parameters to fastControl, which owns the PID and the INA219.
+void publishFastParams(const ControlParams &params) {
+  FastControlParams fastParams;
+  fastParams.version = ++fastParamsVersion;
+  fastParams.setpoint_mA = (float)params.targetCurrent_mA;
+  fastParams.kp = (float)params.kp;
+  fastParams.ki = (float)params.ki;
+  fastParams.kd = (float)params.kd;
+  ina219Calibration(params.maxCurrentLimit_mA / 1000.0, SHUNT_RESISTOR_OHMS, fastParams.calibration, fastParams.currentLsb_mA);
+  fastControl.setParams(fastParams);
+}
+#endif
+
+// Parameters currently in effect, as last published by the control step.
+ControlParams viewControlParams() {
+  static ControlParams view = activeParams;
+  paramBlock.tryRead(view);
+  return view;
+}
+
+// Drains the whole command queue at the start of a control tick. Arrivals
+// go to commandLatency, which records them once an output is written.
+void applyPendingCommands() {
+  ControlParams next = activeParams;
+  uint32_t applied = drainCommands(commandQueue, commandLatency, micros(), [&](const ControlCommand &command) {
+    switch (command.type) {
+      case CMD_SET_CURRENT:
+        next.targetCurrent_mA = min(command.a, next.maxCurrentLimit_mA);
+        break;
+      case CMD_SET_PID:
+        next.kp = command.a;
+        next.ki = command.b;
+        next.kd = command.c;
+        break;
+      case CMD_SET_MAX_LIMIT:
+        next.maxCurrentLimit_mA = command.a;
+        if (next.targetCurrent_mA > next.maxCurrentLimit_mA) next.targetCurrent_mA = next.maxCurrentLimit_mA;
+        break;
+      case CMD_SET_DEADBAND:
+        deltaPublisher.setDeadbands(command.a, command.b);
+        break;
+      case CMD_SET_SERIAL_STREAM:
+        serialStreamEnabled = command.a != 0;
+        break;
+      case CMD_CLEAR_LOAD_FAULT:
+        if (loadFaults.getFault() != LOAD_FAULT_NONE) logEvent(EVENT_LOAD_FAULT_CLEAR, loadFaults.getFault());
+        loadFaults.clear();
+        break;
+      case CMD_CLEAR_ALARMS:
+        if (alarms.getLatched() != 0) logEvent(EVENT_ALARM_CLEAR, 0, alarms.getLatched());
+        alarms.clear();
+        break;
+#if I2C_FAULT_INJECTION
+      case CMD_INJECT_I2C_FAULTS:
+        sensorLink.injectFaults((uint16_t)command.a);
+        break;
+#endif
+      case CMD_SET_UDP_STREAM:
+        udpTelemetry.configure((uint16_t)command.b, (uint8_t)command.c);
+        udpTelemetry.setEnabled(command.a != 0);
+        break;
+    }
+  });
+  if (applied == 0) return;
+
+  if (next.targetCurrent_mA != activeParams.targetCurrent_mA) {
+    logEvent(EVENT_SETPOINT, 0, next.targetCurrent_mA, activeParams.targetCurrent_mA);
+  }
+  if (next.kp != activeParams.kp || next.ki != activeParams.ki || next.kd != activeParams.kd) {
+    logEvent(EVENT_PID_TUNING, 0, next.kp, next.ki, next.kd);
+  }
+  if (next.maxCurrentLimit_mA != activeParams.maxCurrentLimit_mA) {
+    logEvent(EVENT_CALIBRATION, 0, next.maxCurrentLimit_mA, SHUNT_RESISTOR_OHMS);
+  }
+
+#if FAST_CONTROL
+  publishFastParams(next);
+#else
+  if (next.kp != activeParams.kp || next.ki != activeParams.ki || next.kd != activeParams.kd) {
+    myPID.SetTunings(next.kp, next.ki, next.kd);
+  }
+  if (next.maxCurrentLimit_mA != activeParams.maxCurrentLimit_mA) {
+    #if DUAL_CORE_ACQUISITION
+      acquisitionLimit_mA.write(next.maxCurrentLimit_mA);
+    #else
+      ina219.setMaxCurrentShunt(next.maxCurrentLimit_mA / 1000.0, SHUNT_RESISTOR_OHMS);
+    #endif
+  }
+#endif
+  Setpoint = next.targetCurrent_mA;
+  activeParams = next;
+  paramBlock.write(activeParams);
+}
 
 
 // --- Handler Functions for WebServer ---
-void handleRoot() { server.send_P(200, "text/html", index_html); }
+// The page is sent in chunks with the control step serviced in between, so
+// a page load never delays a control deadline by more than one chunk.
+void handleRoot() {
+  size_t total = sizeof(index_html) - 1;
+  server.setContentLength(total);
+  server.send(200, "text/html", "");
+  for (size_t offset = 0; offset < total; offset += WEB_CHUNK_BYTES) {
+    server.sendContent_P(index_html + offset, min((size_t)WEB_CHUNK_BYTES, total - offset));
+    serviceControl();
+  }
+}
+
+size_t buildJsonSnapshot(uint8_t *buf, size_t capacity) {
+  ControlParams params = viewControlParams();
+  int len = snprintf((char *)buf, capacity,
+      "{\"voltage\":%.2f, \"current\":%.2f, \"setpoint\":%.2f, \"kp\":%.2f, \"ki\":%.2f, \"kd\":%.2f, \"max_limit\":%.2f}",
+      busVoltage_V, current_mA, (float)params.targetCurrent_mA, (float)params.kp, (float)params.ki, (float)params.kd,
+      (float)params.maxCurrentLimit_mA);
+  return len < 0 || (size_t)len >= capacity ? 0 : (size_t)len;
+}
+
+size_t buildBinarySnapshot(uint8_t *buf, size_t capacity) {
+  ControlParams params = viewControlParams();
+  DataSnapshot snapshot;
+  snapshot.version = DATA_SNAPSHOT_VERSION;
+  snapshot.flags = lastSample.flags;
+  snapshot.reserved = 0;
+  snapshot.seq = lastSample.seq;
+  snapshot.voltage_V = busVoltage_V;
+  snapshot.current_mA = current_mA;
+  snapshot.setpoint_mA = (float)params.targetCurrent_mA;
+  snapshot.kp = (float)params.kp;
+  snapshot.ki = (float)params.ki;
+  snapshot.kd = (float)params.kd;
+  snapshot.maxLimit_mA = (float)params.maxCurrentLimit_mA;
+  // Both ESP targets are little-endian, so the struct is the wire format.
+  memcpy(buf, &snapshot, sizeof(snapshot));
+  return sizeof(snapshot);
+}
+
+size_t buildCborSnapshot(uint8_t *buf, size_t capacity) {
+  ControlParams params = viewControlParams();
+  CborWriter cbor(buf, capacity);
+  cbor.map(8);
+  cbor.entry("seq", lastSample.seq);
+  cbor.entry("voltage", busVoltage_V);
+  cbor.entry("current", current_mA);
+  cbor.entry("setpoint", (float)params.targetCurrent_mA);
+  cbor.entry("kp", (float)params.kp);
+  cbor.entry("ki", (float)params.ki);
+  cbor.entry("kd", (float)params.kd);
+  cbor.entry("max_limit", (float)params.maxCurrentLimit_mA);
+  return cbor.overflow() ? 0 : cbor.size();
+}
+
+// Sends a cached payload, or 304 if the client already holds this version.
+template <size_t N>
+void sendCachedPayload(const PayloadCache<N> &cache, const char *contentType) {
+  char etag[PayloadCache<N>::ETAG_SIZE];
+  cache.etag(etag, sizeof(etag));
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("Vary", "Accept");
+  if (cache.matches(server.header("If-None-Match").c_str())) {
+    server.send(304);
+    return;
+  }
+  server.setContentLength(cache.size());
+  server.send(200, contentType, "");
+  server.sendContent((const char *)cache.bytes(), cache.size());
+}
+
+// Long-poll variant of /data: /data?wait=<ms>&seq=<n>. Returns as soon as
+// the deadband-filtered state has moved past publication n, or after the
+// wait expires, with only the fields the client is missing. The control
+// loop, SCPI and UDP telemetry keep running while the request is parked,
+// and the wait is cut short whenever another HTTP client is queued.
+void handleLongPoll() {
+    uint32_t clientSeq = server.hasArg("seq") ? (uint32_t)server.arg("seq").toInt() : 0;
+    uint32_t wait_ms = min((uint32_t)server.arg("wait").toInt(), (uint32_t)LONGPOLL_MAX_WAIT_MS);
+    uint32_t start = millis();
+    uint32_t parkStart_us = micros();
+    while (deltaPublisher.getSeq() == clientSeq && millis() - start < wait_ms) {
+        if (server.hasPendingClient()) break;
+        serviceControl();
+        handleScpi();
+        udpTelemetry.send();
+        yield();
+    }
+    scheduler.excludeFromWebSlice(micros() - parkStart_us); // Waiting is not web work
+
+    static const char *const fieldNames[DELTA_FIELD_COUNT] = {
+        "voltage", "current", "setpoint", "kp", "ki", "kd", "max_limit", "flags"};
+    uint16_t changed = deltaPublisher.changedSince(clientSeq);
+    char json[48 + DELTA_FIELD_COUNT * (16 + JSON_FLOAT_CHARS)];
+    size_t len = snprintf(json, sizeof(json), "{\"seq\":%lu, \"full\":%s",
+                          (unsigned long)deltaPublisher.getSeq(), changed == DELTA_ALL_FIELDS ? "true" : "false");
+    for (uint8_t i = 0; i < DELTA_FIELD_COUNT && len < sizeof(json); i++) {
+        if (changed & (1u << i)) {
+            len += snprintf(json + len, sizeof(json) - len, ", \"%s\":%.2f", fieldNames[i], deltaPublisher.value(i));
+        }
+    }
+    if (len + 1 >= sizeof(json)) {
+        server.send(500, "text/plain", "Delta too large");
+        return;
+    }
+    snprintf(json + len, sizeof(json) - len, "}");
+    server.sendHeader("Cache-Control", "no-store");
+    server.send(200, "application/json", json);
+}
+
+// /data?agg=1[&cid=<id>]: the latest snapshot plus min/max/mean of the
+// samples since this client's previous request. Clients are told apart by
+// remote address and the optional cid, so several tabs on one host work.
+// Per-client, so never cached or revalidated.
+void handleAggregateData(bool binary, uint32_t tick) {
+    uint32_t clientId = (uint32_t)server.client().remoteIP();
+    if (server.hasArg("cid")) clientId = fnv1a(server.arg("cid").c_str(), clientId);
+    ClientAggregate agg = clientAggregator.take(clientId, millis());
+
+    // An empty interval reports the instantaneous values.
+    if (agg.current_mA.count == 0) {
+        agg.current_mA.min = agg.current_mA.max = current_mA;
+        agg.voltage_V.min = agg.voltage_V.max = busVoltage_V;
+    }
+
+    server.sendHeader("Cache-Control", "no-store");
+    if (binary) {
+        DataAggregate wire;
+        wire.count = agg.current_mA.count;
+        wire.currentMin_mA = agg.current_mA.min;
+        wire.currentMax_mA = agg.current_mA.max;
+        wire.currentMean_mA = agg.current_mA.count ? agg.current_mA.mean() : current_mA;
+        wire.voltageMin_V = agg.voltage_V.min;
+        wire.voltageMax_V = agg.voltage_V.max;
+        wire.voltageMean_V = agg.voltage_V.count ? agg.voltage_V.mean() : busVoltage_V;
+
+        binarySnapshot.refresh(tick, buildBinarySnapshot);
+        server.setContentLength(binarySnapshot.size() + sizeof(wire));
+        server.send(200, "application/octet-stream", "");
+        server.sendContent((const char *)binarySnapshot.bytes(), binarySnapshot.size());
+        server.sendContent((const char *)&wire, sizeof(wire));
+        return;
+    }
+
+    jsonSnapshot.refresh(tick, buildJsonSnapshot);
+    if (jsonSnapshot.size() == 0) {
+        server.send(500, "text/plain", "Snapshot unavailable");
+        return;
+    }
+    char suffix[128 + 6 * JSON_FLOAT_CHARS];
+    int len = snprintf(suffix, sizeof(suffix),
+             ", \"count\":%lu, \"current_min\":%.2f, \"current_max\":%.2f, \"current_mean\":%.2f"
+             ", \"voltage_min\":%.2f, \"voltage_max\":%.2f, \"voltage_mean\":%.2f}",
+             (unsigned long)agg.current_mA.count, agg.current_mA.min, agg.current_mA.max,
+             agg.current_mA.count ? agg.current_mA.mean() : current_mA,
+             agg.voltage_V.min, agg.voltage_V.max,
+             agg.voltage_V.count ? agg.voltage_V.mean() : busVoltage_V);
+    if (len < 0 || (size_t)len >= sizeof(suffix)) {
+        server.send(500, "text/plain", "Snapshot unavailable");
+        return;
+    }
+    // The cached object is sent without its closing brace and reopened.
+    server.setContentLength(jsonSnapshot.size() - 1 + len);
+    server.send(200, "application/json", "");
+    server.sendContent((const char *)jsonSnapshot.bytes(), jsonSnapshot.size() - 1);
+    server.sendContent(suffix, len);
+}
 
 void handleData() {
-    String jsonData = "{";
-    jsonData += "\"voltage\":" + String(busVoltage_V, 2);
-    jsonData += ", \"current\":" + String(current_mA, 2);
-    jsonData += ", \"setpoint\":" + String(targetCurrent_mA, 2);
-    jsonData += ", \"kp\":" + String(Kp);
-    jsonData += ", \"ki\":" + String(Ki);
-    jsonData += ", \"kd\":" + String(Kd);
-    jsonData += ", \"max_limit\":" + String(maxCurrentLimit_mA);
-    jsonData += "}";
-    server.send(200, "application/json", jsonData);
+    if (server.hasArg("wait")) {
+        handleLongPoll();
+        return;
+    }
+    // Each encoding is rebuilt at most once per control sample or
+    // parameter change, and only when a client actually asks for it.
+    // Parameters only change at tick boundaries, so the sample sequence
+    // number also covers parameter updates.
+    uint32_t tick = sampleSeq;
+    String accept = server.header("Accept");
+    if (server.hasArg("agg")) {
+        handleAggregateData(accept.indexOf("application/octet-stream") >= 0, tick);
+    } else if (accept.indexOf("application/octet-stream") >= 0) {
+        binarySnapshot.refresh(tick, buildBinarySnapshot);
+        sendCachedPayload(binarySnapshot, "application/octet-stream");
+    } else if (accept.indexOf("application/cbor") >= 0) {
+        cborSnapshot.refresh(tick, buildCborSnapshot);
+        sendCachedPayload(cborSnapshot, "application/cbor");
+    } else {
+        jsonSnapshot.refresh(tick, buildJsonSnapshot);
+        sendCachedPayload(jsonSnapshot, "application/json");
+    }
+}
+
+// Replies to a state-changing request once its command has been queued.
+void sendQueued(bool queued) {
+  if (queued) server.send(200, "text/plain", "OK");
+  else server.send(503, "text/plain", "Busy");
 }
 
 void handleSet() {
   if (server.hasArg("current")) {
-    double reqCurrent = server.arg("current").toDouble();
-    targetCurrent_mA = min(reqCurrent, maxCurrentLimit_mA);
-    Setpoint = targetCurrent_mA;
-    server.send(200, "text/plain", "OK");
+    double requested_mA = server.arg("current").toDouble();
+    if (!validTargetCurrent(requested_mA)) { server.send(400, "text/plain", "Out of range"); return; }
+    sendQueued(applyTargetCurrent(requested_mA));
   } else { server.send(400, "text/plain", "Bad Request"); }
 }
 
 void handleSetPid() {
   if (server.hasArg("kp") && server.hasArg("ki") && server.hasArg("kd")) {
-    Kp = server.arg("kp").toDouble();
-    Ki = server.arg("ki").toDouble();
-    Kd = server.arg("kd").toDouble();
-    myPID.SetTunings(Kp, Ki, Kd);
-    server.send(200, "text/plain", "OK");
+    sendQueued(applyPidTunings(server.arg("kp").toDouble(), server.arg("ki").toDouble(), server.arg("kd").toDouble()));
   } else { server.send(400, "text/plain", "Bad Request"); }
 }
 
 void handleSetAdvanced() {
+    bool handled = false;
+    bool queued = true;
     if (server.hasArg("max")) {
-        maxCurrentLimit_mA = server.arg("max").toDouble();
-        ina219.setMaxCurrentShunt(maxCurrentLimit_mA / 1000.0, SHUNT_RESISTOR_OHMS);
-        if (targetCurrent_mA > maxCurrentLimit_mA) {
-            targetCurrent_mA = maxCurrentLimit_mA;
-            Setpoint = targetCurrent_mA;
-        }
-        server.send(200, "text/plain", "OK");
+        queued &= applyMaxCurrentLimit(server.arg("max").toDouble());
+        handled = true;
+    }
+    if (server.hasArg("clear_fault")) {
+        queued &= postCommand(CMD_CLEAR_LOAD_FAULT);
+        handled = true;
+    }
+    if (server.hasArg("clear_alarms")) {
+        queued &= postCommand(CMD_CLEAR_ALARMS);
+        handled = true;
+    }
+    if (server.hasArg("deadband_ma") || server.hasArg("deadband_v")) {
+        float deadband_mA = server.hasArg("deadband_ma") ? server.arg("deadband_ma").toDouble() : deltaPublisher.getDeadband(DELTA_CURRENT);
+        float deadband_V = server.hasArg("deadband_v") ? server.arg("deadband_v").toDouble() : deltaPublisher.getDeadband(DELTA_VOLTAGE);
+        queued &= postCommand(CMD_SET_DEADBAND, max(deadband_mA, 0.0f), max(deadband_V, 0.0f));
+        handled = true;
+    }
+    if (handled) {
+        sendQueued(queued);
     } else {
         server.send(400, "text/plain", "Bad Request");
     }
 }
 
+// Control timing and web budget overruns, in microseconds.
+void handleSchedulerStats() {
+    const SchedulerStats &stats = scheduler.getStats();
+    char json[768];
+    snprintf(json, sizeof(json),
+             "{\"period_us\":%lu, \"ticks\":%lu, \"late_ticks\":%lu, \"missed_ticks\":%lu, \"max_lateness_us\":%lu"
+             ", \"max_step_us\":%lu, \"web_overruns\":%lu, \"max_web_slice_us\":%lu, \"voltage_guard_entries\":%lu"
+             ", \"dac_writes\":%lu, \"dac_skips\":%lu, \"recoveries\":%lu, \"last_recovery_us\":%lu"
+             ", \"max_recovery_us\":%lu, \"compliance_caps\":%lu, \"load_fault\":\"%s\", \"open_faults\":%lu"
+             ", \"short_faults\":%lu, \"sensor_degraded\":%s, \"sensor_errors\":%lu, \"sensor_losses\":%lu"
+             ", \"recovery_attempts\":%lu, \"sensor_recoveries\":%lu}",
+             (unsigned long)scheduler.getPeriod(), (unsigned long)stats.ticks, (unsigned long)stats.lateTicks,
+             (unsigned long)stats.missedTicks, (unsigned long)stats.maxLateness_us, (unsigned long)stats.maxStep_us,
+             (unsigned long)stats.webOverruns, (unsigned long)stats.maxWebSlice_us,
+             (unsigned long)sensorSchedule.getFullRateEntries(), (unsigned long)outputStage.getWrites(),
+             (unsigned long)outputStage.getSkips(), (unsigned long)complianceRecovery.getCount(),
+             (unsigned long)complianceRecovery.getLast_us(), (unsigned long)complianceRecovery.getMax_us(),
+             (unsigned long)complianceCaps, loadFaultName(loadFaults.getFault()),
+             (unsigned long)loadFaults.getOpenCount(), (unsigned long)loadFaults.getShortCount(),
+             sensorLink.isDegraded() ? "true" : "false", (unsigned long)sensorLink.getErrors(),
+             (unsigned long)sensorLink.getDegradations(), (unsigned long)sensorLink.getAttempts(),
+             (unsigned long)sensorLink.getRecoveries());
+#if DUAL_CORE_ACQUISITION
+    size_t len = strlen(json) - 1; // Reopen the object for the pipeline figures
+    snprintf(json + len, sizeof(json) - len, ", \"stale_ticks\":%lu, \"overwritten_samples\":%lu}",
+             (unsigned long)staleControlTicks, (unsigned long)acquisitionMailbox.getOverwritten());
+#endif
+#if ASYNC_ACQUISITION
+    size_t len = strlen(json) - 1; // Reopen the object for the async I2C figures
+    snprintf(json + len, sizeof(json) - len, ", \"stale_ticks\":%lu, \"i2c_reads\":%lu, \"i2c_errors\":%lu}",
+             (unsigned long)staleControlTicks, (unsigned long)asyncI2c.getCompleted(),
+             (unsigned long)asyncI2c.getErrors());
+#endif
+#if FAST_CONTROL
+    size_t len = strlen(json) - 1; // Reopen the object for the fast path figures
+    snprintf(json + len, sizeof(json) - len,
+             ", \"fast_max_step_us\":%lu, \"fast_max_jitter_us\":%lu, \"fast_i2c_errors\":%lu, \"fast_dropped\":%lu"
+             ", \"fast_overruns\":%lu}",
+             (unsigned long)fastControl.getMaxStep_us(), (unsigned long)fastControl.getMaxJitter_us(),
+             (unsigned long)fastControl.getI2cErrors(), (unsigned long)fastControl.getDroppedSamples(),
+             (unsigned long)fastControl.getOverruns());
+#endif
+#if WATCHDOG_SUPERVISOR
+    {
+        size_t len = strlen(json) - 1; // Reopen the object for the watchdog figures
+        snprintf(json + len, sizeof(json) - len, ", \"deadline_misses\":%lu, \"watchdog_trips\":%lu, \"longest_stall_us\":%lu}",
+                 (unsigned long)controlWatchdog.getDeadlineMisses(), (unsigned long)controlWatchdog.getTrips(),
+                 (unsigned long)controlWatchdog.getLongestGap_us());
+    }
+#endif
+    server.sendHeader("Cache-Control", "no-store");
+    server.send(200, "application/json", json);
+}
+
+void formatEventJson(char *json, size_t capacity, const char *separator, const EventRecord &event) {
+    snprintf(json, capacity,
+             "%s{\"seq\":%lu, \"t_ms\":%lu, \"type\":\"%s\", \"code\":%u, \"value\":[%g,%g,%g]}",
+             separator, (unsigned long)event.seq, (unsigned long)event.time_ms, eventTypeName(event.type),
+             (unsigned)event.code, event.value[0], event.value[1], event.value[2]);
+}
+
+// Events after a sequence number: /events?since=<seq>. JSON by default;
+// "Accept: application/octet-stream" gets the packed EventRecords. Events
+// are overwritten oldest first, so "oldest" above since + 1 (or a gap in
+// the binary sequence numbers) means some were lost before this request.
+void handleEvents() {
+    uint32_t since = server.hasArg("since") ? (uint32_t)server.arg("since").toInt() : 0;
+    uint32_t latest = eventLog.latestSeq();
+    bool binary = server.header("Accept").indexOf("application/octet-stream") >= 0;
+    server.sendHeader("Cache-Control", "no-store");
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, binary ? "application/octet-stream" : "application/json", "");
+
+    char json[160];
+    if (!binary) {
+        snprintf(json, sizeof(json), "{\"oldest\":%lu, \"latest\":%lu, \"events\":[",
+                 (unsigned long)eventLog.oldestSeq(), (unsigned long)latest);
+        server.sendContent(json);
+    }
+    const char *separator = "";
+    for (uint32_t seq = max(since + 1, eventLog.oldestSeq()); seq <= latest; seq++) {
+        const EventRecord *found = eventLog.find(seq);
+        if (found == nullptr) continue; // Overwritten while this response was going out
+        EventRecord event = *found;
+        if (binary) {
+            server.sendContent((const char *)&event, sizeof(event));
+        } else {
+            formatEventJson(json, sizeof(json), separator, event);
+            server.sendContent(json);
+            separator = ", ";
+        }
+        serviceControl();
+    }
+    if (!binary) server.sendContent("]}");
+    server.sendContent(""); // End of the chunked response
+}
+
+#if FLIGHT_RECORDER
+// What the previous run recorded before this boot, oldest first, with the
+// reason for the reset. "recorded" is false after a cold power-up.
+void handleFlightRecord() {
+    const ControllerFlightRecorder::Log &log = flightRecorder.getPreviousLog();
+    bool recorded = flightRecorder.hasPreviousLog();
+    server.sendHeader("Cache-Control", "no-store");
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+
+    char json[160];
+    snprintf(json, sizeof(json),
+             "{\"reset_reason\":\"%s\", \"recorded\":%s, \"boots\":%lu"
+             ", \"sample_fields\":[\"seq\",\"t_us\",\"current_mA\",\"voltage_V\",\"output\",\"flags\"], \"samples\":[",
+             resetReason().c_str(), recorded ? "true" : "false", recorded ? (unsigned long)log.boots : 0ul);
+    server.sendContent(json);
+    const char *separator = "";
+    uint16_t start = ControllerFlightRecorder::oldestSlot(log.samples, FLIGHT_RECORDER_SAMPLES);
+    for (uint16_t i = 0; recorded && i < FLIGHT_RECORDER_SAMPLES; i++) {
+        const FlightSample &sample = log.samples[(start + i) % FLIGHT_RECORDER_SAMPLES];
+        if (sample.seq == 0) continue;
+        snprintf(json, sizeof(json), "%s[%lu,%lu,%.2f,%.3f,%u,%u]", separator, (unsigned long)sample.seq,
+                 (unsigned long)sample.timestamp_us, sample.current_mA, sample.voltage_mV / 1000.0,
+                 (unsigned)sample.output, (unsigned)sample.flags);
+        server.sendContent(json);
+        separator = ",";
+        serviceControl();
+    }
+    server.sendContent("], \"events\":[");
+    separator = "";
+    start = ControllerFlightRecorder::oldestSlot(log.events, FLIGHT_RECORDER_EVENTS);
+    for (uint16_t i = 0; recorded && i < FLIGHT_RECORDER_EVENTS; i++) {
+        const EventRecord &event = log.events[(start + i) % FLIGHT_RECORDER_EVENTS];
+        if (event.seq == 0) continue;
+        formatEventJson(json, sizeof(json), separator, event);
+        server.sendContent(json);
+        separator = ", ";
+    }
+    server.sendContent("]}");
+    server.sendContent(""); // End of the chunked response
+}
+#endif
+
+// Alarm rules with their latched state and trip counts.
+void handleAlarms() {
+    server.sendHeader("Cache-Control", "no-store");
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+
+    char json[256];
+    snprintf(json, sizeof(json), "{\"latched\":%lu, \"rules\":[", (unsigned long)alarms.getLatched());
+    server.sendContent(json);
+    for (uint8_t i = 0; i < alarms.getCount(); i++) {
+        const AlarmRule &rule = alarms.getRule(i);
+        snprintf(json, sizeof(json),
+                 "%s{\"quantity\":\"%s\", \"condition\":\"%s\", \"threshold\":%g, \"samples\":%u"
+                 ", \"hold_ms\":%lu, \"safe_output\":%s, \"latched\":%s, \"trips\":%lu, \"trip_value\":%g}",
+                 i == 0 ? "" : ", ", alarmQuantityName(rule.quantity), rule.condition == ALARM_ABOVE ? "above" : "below",
+                 rule.threshold, (unsigned)rule.samples, (unsigned long)rule.hold_ms, rule.safeOutput ? "true" : "false",
+                 (alarms.getLatched() & (1u << i)) ? "true" : "false", (unsigned long)alarms.getTrips(i),
+                 alarms.getTripValue(i));
+        server.sendContent(json);
+    }
+    server.sendContent("]}");
+    server.sendContent(""); // End of the chunked response
+}
+
+// Command-to-actuation latency of queued commands, in microseconds.
+void handleLatency() {
+    LatencyStats stats = commandLatency.stats();
+    char json[160];
+    snprintf(json, sizeof(json),
+             "{\"count\":%lu, \"p50_us\":%lu, \"p90_us\":%lu, \"p99_us\":%lu, \"max_us\":%lu, \"rejected\":%lu}",
+             (unsigned long)stats.count, (unsigned long)stats.p50_us, (unsigned long)stats.p90_us,
+             (unsigned long)stats.p99_us, (unsigned long)stats.max_us, (unsigned long)commandsRejected);
+    server.sendHeader("Cache-Control", "no-store");
+    server.send(200, "application/json", json);
+}
+
+// --- SCPI Command Handlers ---
+// SCPI uses SI units (A, V); the rest of the firmware works in mA.
+void scpiIdn(ScpiContext &ctx) { ctx.out.print("QuartzAl,ESP-CurrentSource,0,v12\n"); }
+
+void scpiPrintValue(ScpiContext &ctx, double value) {
+  ctx.out.print(value, 6);
+  ctx.out.print('\n');
+}
+
+void scpiSetCurrent(ScpiContext &ctx) {
+  double amps;
+  if (!ctx.nextDouble(amps)) return;
+  if (!validTargetCurrent(amps * 1000.0)) { ctx.error(SCPI_ERR_DATA_OUT_OF_RANGE); return; }
+  if (!applyTargetCurrent(amps * 1000.0)) ctx.error(SCPI_ERR_EXECUTION);
+}
+
+void scpiGetCurrent(ScpiContext &ctx) { scpiPrintValue(ctx, viewControlParams().targetCurrent_mA / 1000.0); }
+
+void scpiSetCurrentLimit(ScpiContext &ctx) {
+  double amps;
+  if (!ctx.nextDouble(amps)) return;
+  if (amps <= 0) { ctx.error(SCPI_ERR_DATA_OUT_OF_RANGE); return; }
+  if (!applyMaxCurrentLimit(amps * 1000.0)) ctx.error(SCPI_ERR_EXECUTION);
+}
+
+void scpiGetCurrentLimit(ScpiContext &ctx) { scpiPrintValue(ctx, viewControlParams().maxCurrentLimit_mA / 1000.0); }
+
+void scpiSetPid(ScpiContext &ctx) {
+  double kp, ki, kd;
+  if (!ctx.nextDouble(kp) || !ctx.nextDouble(ki) || !ctx.nextDouble(kd)) return;
+  if (kp < 0 || ki < 0 || kd < 0) { ctx.error(SCPI_ERR_DATA_OUT_OF_RANGE); return; }
+  if (!applyPidTunings(kp, ki, kd)) ctx.error(SCPI_ERR_EXECUTION);
+}
+
+void scpiGetPid(ScpiContext &ctx) {
+  ControlParams params = viewControlParams();
+  ctx.out.print(params.kp, 4); ctx.out.print(',');
+  ctx.out.print(params.ki, 4); ctx.out.print(',');
+  ctx.out.print(params.kd, 4); ctx.out.print('\n');
+}
+
+void scpiMeasCurrent(ScpiContext &ctx) { scpiPrintValue(ctx, current_mA / 1000.0); }
+void scpiMeasVoltage(ScpiContext &ctx) { scpiPrintValue(ctx, busVoltage_V); }
+
+// Stream settings as last requested over SCPI; the control step owns the
+// live ones and picks these up through the command queue.
+bool requestedSerialStream = SERIAL_STREAM_ON_BOOT;
+bool requestedUdpStream = UDP_STREAM_ON_BOOT;
+uint16_t requestedUdpDecimation = UDP_STREAM_DECIMATION;
+uint8_t requestedUdpBatch = UDP_STREAM_BATCH;
+
+void scpiPostUdpSettings(ScpiContext &ctx) {
+  if (!postCommand(CMD_SET_UDP_STREAM, requestedUdpStream, requestedUdpDecimation, requestedUdpBatch)) {
+    ctx.error(SCPI_ERR_EXECUTION);
+  }
+}
+
+void scpiSetStream(ScpiContext &ctx) {
+  bool enable;
+  if (!ctx.nextBool(enable)) return;
+  requestedSerialStream = enable;
+  if (!postCommand(CMD_SET_SERIAL_STREAM, enable)) ctx.error(SCPI_ERR_EXECUTION);
+}
+
+void scpiGetStream(ScpiContext &ctx) { ctx.out.print(requestedSerialStream ? "1\n" : "0\n"); }
+
+void scpiSetUdp(ScpiContext &ctx) {
+  bool enable;
+  if (!ctx.nextBool(enable)) return;
+  requestedUdpStream = enable;
+  scpiPostUdpSettings(ctx);
+}
+
+void scpiGetUdp(ScpiContext &ctx) { ctx.out.print(requestedUdpStream ? "1\n" : "0\n"); }
+
+void scpiSetUdpDecimation(ScpiContext &ctx) {
+  double value;
+  if (!ctx.nextDouble(value)) return;
+  if (value < 1 || value > 65535) { ctx.error(SCPI_ERR_DATA_OUT_OF_RANGE); return; }
+  requestedUdpDecimation = (uint16_t)value;
+  scpiPostUdpSettings(ctx);
+}
+
+void scpiGetUdpDecimation(ScpiContext &ctx) {
+  ctx.out.print(requestedUdpDecimation);
+  ctx.out.print('\n');
+}
+
+void scpiSetUdpBatch(ScpiContext &ctx) {
+  double value;
+  if (!ctx.nextDouble(value)) return;
+  if (value < 1 || value > UDP_TELEMETRY_MAX_BATCH) { ctx.error(SCPI_ERR_DATA_OUT_OF_RANGE); return; }
+  requestedUdpBatch = (uint8_t)value;
+  scpiPostUdpSettings(ctx);
+}
+
+void scpiGetUdpBatch(ScpiContext &ctx) {
+  ctx.out.print(requestedUdpBatch);
+  ctx.out.print('\n');
+}
+
+// Command-to-actuation latency: count,p50,p90,p99,max (microseconds).
+void scpiGetLatency(ScpiContext &ctx) {
+  LatencyStats stats = commandLatency.stats();
+  ctx.out.print(stats.count); ctx.out.print(',');
+  ctx.out.print(stats.p50_us); ctx.out.print(',');
+  ctx.out.print(stats.p90_us); ctx.out.print(',');
+  ctx.out.print(stats.p99_us); ctx.out.print(',');
+  ctx.out.print(stats.max_us); ctx.out.print('\n');
+}
+
+// Times PID_v1's double arithmetic (BasicPID<double>) against FloatPID on a
+// simulated step response with the active tunings. Reports the average
+// cycles per Compute for each and the largest output difference:
+// double cycles,float cycles,max |difference|.
+void scpiPidBenchmark(ScpiContext &ctx) {
+  const uint16_t steps = 1000;
+  ControlParams params = viewControlParams();
+  double dIn = 0, dOut = 0, dSet = params.targetCurrent_mA;
+  float fIn = 0, fOut = 0, fSet = (float)params.targetCurrent_mA;
+  BasicPID<double> reference(&dIn, &dOut, &dSet, params.kp, params.ki, params.kd, DIRECT);
+  FloatPID candidate(&fIn, &fOut, &fSet, (float)params.kp, (float)params.ki, (float)params.kd, DIRECT);
+  reference.SetMode(AUTOMATIC);
+  candidate.SetMode(AUTOMATIC);
+
+  uint32_t doubleCycles = 0, floatCycles = 0;
+  double maxDiff = 0, plant = 0;
+  for (uint16_t i = 0; i < steps; i++) {
+    unsigned long now = i * 100UL; // One sample time per step
+    dIn = plant;
+    fIn = (float)plant;
+    uint32_t t0 = ESP.getCycleCount();
+    reference.ComputeAt(now);
+    uint32_t t1 = ESP.getCycleCount();
+    candidate.ComputeAt(now);
+    uint32_t t2 = ESP.getCycleCount();
+    doubleCycles += t1 - t0;
+    floatCycles += t2 - t1;
+    maxDiff = max(maxDiff, fabs(dOut - (double)fOut));
+    plant += (dOut * params.maxCurrentLimit_mA / 255.0 - plant) * 0.2; // First-order lag
+  }
+  ctx.out.print(doubleCycles / steps); ctx.out.print(',');
+  ctx.out.print(floatCycles / steps); ctx.out.print(',');
+  ctx.out.print(maxDiff, 6); ctx.out.print('\n');
+}
+
+// Latched load fault: none, open or short.
+void scpiGetFault(ScpiContext &ctx) {
+  ctx.out.print(loadFaultName(loadFaults.getFault()));
+  ctx.out.print('\n');
+}
+
+void scpiClearFault(ScpiContext &ctx) {
+  if (!postCommand(CMD_CLEAR_LOAD_FAULT)) ctx.error(SCPI_ERR_EXECUTION);
+}
+
+// Bit mask of the latched alarm rules, in ALARM_RULES order.
+void scpiGetAlarms(ScpiContext &ctx) {
+  ctx.out.print(alarms.getLatched());
+  ctx.out.print('\n');
+}
+
+void scpiClearAlarms(ScpiContext &ctx) {
+  if (!postCommand(CMD_CLEAR_ALARMS)) ctx.error(SCPI_ERR_EXECUTION);
+}
+
+// Sensor link: degraded (0/1), read errors, losses, recovery attempts, recoveries.
+void scpiGetI2c(ScpiContext &ctx) {
+  ctx.out.print(sensorLink.isDegraded() ? 1 : 0); ctx.out.print(',');
+  ctx.out.print(sensorLink.getErrors()); ctx.out.print(',');
+  ctx.out.print(sensorLink.getDegradations()); ctx.out.print(',');
+  ctx.out.print(sensorLink.getAttempts()); ctx.out.print(',');
+  ctx.out.print(sensorLink.getRecoveries()); ctx.out.print('\n');
+}
+
+#if I2C_FAULT_INJECTION
+void scpiInjectI2cFaults(ScpiContext &ctx) {
+  double count;
+  if (!ctx.nextDouble(count)) return;
+  if (count < 0 || count > 65535) { ctx.error(SCPI_ERR_DATA_OUT_OF_RANGE); return; }
+  if (!postCommand(CMD_INJECT_I2C_FAULTS, count)) ctx.error(SCPI_ERR_EXECUTION);
+}
+#endif
+
+void scpiSystError(ScpiContext &ctx) {
+  int code = ctx.errors.pop();
+  ctx.out.print(code);
+  ctx.out.print(",\"");
+  ctx.out.print(scpiErrorString(code));
+  ctx.out.print("\"\n");
+}
+
+// Scheduler statistics: ticks,late,missed,max lateness,max step,web overruns.
+void scpiGetScheduler(ScpiContext &ctx) {
+  const SchedulerStats &stats = scheduler.getStats();
+  ctx.out.print(stats.ticks); ctx.out.print(',');
+  ctx.out.print(stats.lateTicks); ctx.out.print(',');
+  ctx.out.print(stats.missedTicks); ctx.out.print(',');
+  ctx.out.print(stats.maxLateness_us); ctx.out.print(',');
+  ctx.out.print(stats.maxStep_us); ctx.out.print(',');
+  ctx.out.print(stats.webOverruns); ctx.out.print('\n');
+}
+
+const ScpiCommand scpiCommands[] = {
+  {"*IDN?", scpiIdn},
+  {"SOURce:CURRent", scpiSetCurrent},
+  {"SOURce:CURRent?", scpiGetCurrent},
+  {"SOURce:CURRent:LIMit", scpiSetCurrentLimit},
+  {"SOURce:CURRent:LIMit?", scpiGetCurrentLimit},
+  {"CONTrol:PID", scpiSetPid},
+  {"CONTrol:PID?", scpiGetPid},
+  {"MEASure:CURRent?", scpiMeasCurrent},
+  {"MEASure:VOLTage?", scpiMeasVoltage},
+  {"SYSTem:ERRor?", scpiSystError},
+  {"SYSTem:STReam", scpiSetStream},
+  {"SYSTem:STReam?", scpiGetStream},
+  {"SYSTem:UDP", scpiSetUdp},
+  {"SYSTem:UDP?", scpiGetUdp},
+  {"SYSTem:UDP:DECimation", scpiSetUdpDecimation},
+  {"SYSTem:UDP:DECimation?", scpiGetUdpDecimation},
+  {"SYSTem:UDP:BATCh", scpiSetUdpBatch},
+  {"SYSTem:UDP:BATCh?", scpiGetUdpBatch},
+  {"SYSTem:LATency?", scpiGetLatency},
+  {"SYSTem:SCHeduler?", scpiGetScheduler},
+  {"SYSTem:PID:BENChmark?", scpiPidBenchmark},
+  {"SYSTem:FAULt?", scpiGetFault},
+  {"SYSTem:FAULt:CLEar", scpiClearFault},
+  {"SYSTem:ALARm?", scpiGetAlarms},
+  {"SYSTem:ALARm:CLEar", scpiClearAlarms},
+  {"SYSTem:I2C?", scpiGetI2c},
+#if I2C_FAULT_INJECTION
+  {"SYSTem:I2C:INJect", scpiInjectI2cFaults},
+#endif
+};
+
+ScpiSession serialScpi(scpiCommands, sizeof(scpiCommands) / sizeof(scpiCommands[0]));
+ScpiSession tcpScpi(scpiCommands, sizeof(scpiCommands) / sizeof(scpiCommands[0]));
+
+void handleScpi() {
+  serialScpi.poll(Serial, SCPI_POLL_BYTES);
+
+  if (scpiServer.hasClient()) {
+    // Only one TCP session at a time; a new connection replaces the old one.
+    if (scpiClient) scpiClient.stop();
+    scpiClient = scpiServer.available();
+    scpiClient.setNoDelay(true);
+    tcpScpi.reset();
+  }
+  if (scpiClient && scpiClient.connected()) {
+    tcpScpi.poll(scpiClient, SCPI_POLL_BYTES);
+  }
+}
+
 // --- Unified output function ---
-void setOutputLevel(double pidOutput) {
-  // This function now relies on the user-provided dacWrite wrapper in util.h
+int setOutputLevel(double pidOutput) {
+  // outputStage relies on the user-provided dacWrite wrapper in util.h
   // to handle the platform-specific output (DAC for ESP32, PWM for ESP8266).
-  int dacValue = constrain((int)pidOutput, 1, 255);
-  dacWrite(DAC_PIN, dacValue);
+  return outputStage.write(constrain((int)pidOutput, 1, 255));
+}
+
+// --- Binary serial telemetry ---
+// Sends one COBS-framed sample. Frames are dropped rather than blocking the
+// control loop when the UART transmit buffer cannot take a whole frame.
+void streamSampleToSerial(const TelemetrySample &sample) {
+  uint8_t raw[TELEMETRY_FRAME_SIZE(1)];
+  uint8_t encoded[COBS_MAX_ENCODED_SIZE(sizeof(raw)) + 1];
+  size_t rawLen = telemetryBuildFrame(&sample, 1, raw);
+  size_t len = cobsEncode(raw, rawLen, encoded);
+  encoded[len++] = 0;
+  if ((size_t)Serial.availableForWrite() < len) {
+    serialStreamDropped++;
+    return;
+  }
+  Serial.write(encoded, len);
 }
 
+// fresh: current_mA was read on this tick rather than held from an earlier
+// one. Only fresh samples go into the per-client aggregates, so a run of
+// stale ticks does not weight min/max/mean toward a repeated value.
+void publishSample(uint32_t timestamp_us, int outputCode, uint8_t flags, bool fresh) {
+  lastSample.seq = ++sampleSeq;
+  lastSample.timestamp_us = timestamp_us;
+  lastSample.current_mA = current_mA;
+  lastSample.voltage_V = busVoltage_V;
+  lastSample.setpoint_mA = (float)Setpoint;
+  lastSample.output = (uint8_t)outputCode;
+  lastSample.flags = flags;
+  if (serialStreamEnabled) streamSampleToSerial(lastSample);
+#if FLIGHT_RECORDER
+  FlightSample flight = {lastSample.seq, timestamp_us, current_mA, (uint16_t)(busVoltage_V * 1000.0f + 0.5f),
+                         lastSample.output, flags};
+  flightRecorder.recordSample(flight);
+#endif
+  udpTelemetry.push(lastSample);
+
+  float deltaValues[DELTA_FIELD_COUNT] = {
+    busVoltage_V, current_mA, (float)activeParams.targetCurrent_mA, (float)activeParams.kp,
+    (float)activeParams.ki, (float)activeParams.kd, (float)activeParams.maxCurrentLimit_mA, (float)flags};
+  deltaPublisher.update(deltaValues);
+  if (fresh) clientAggregator.add(current_mA, busVoltage_V);
+}
+
+#if WATCHDOG_SUPERVISOR
+// Feeds the watchdog. If it forced the safe output while the step was
+// stalled, logs the stall and resyncs the output cache and the PID to the
+// pin, so regulation resumes bumplessly from the safe code. Returns
+// TELEMETRY_FLAG_WATCHDOG on the first step after a trip.
+uint8_t superviseControlStep() {
+  uint32_t gap_us = controlWatchdog.feed(micros());
+  if (!controlWatchdog.takeTrip()) return 0;
+  logEvent(EVENT_WATCHDOG_TRIP, 0, gap_us / 1000.0f);
+  outputStage.invalidate();
+  myPID.SetMode(MANUAL);
+  Output = controlWatchdog.getSafeCode();
+  return TELEMETRY_FLAG_WATCHDOG;
+}
+#endif
+
+// Logs the sensor being lost and restored, and the read errors. Returns
+// TELEMETRY_FLAG_SENSOR_FAULT while the link is degraded.
+uint8_t superviseSensorLink() {
+  bool degraded = sensorLink.isDegraded();
+  if (degraded != sensorWasDegraded) {
+    sensorWasDegraded = degraded;
+    if (degraded) logEvent(EVENT_SENSOR_LOST, sensorLink.getLastError(), sensorLink.getErrors());
+    else logEvent(EVENT_SENSOR_RESTORED, 0, sensorLink.getAttempts(), sensorLink.getRecoveries());
+  }
+  logI2cErrors(sensorLink.getErrors());
+  return degraded ? TELEMETRY_FLAG_SENSOR_FAULT : 0;
+}
+
+// --- Control step: acquire, regulate, actuate, publish ---
+void controlStep() {
+  #if WATCHDOG_SUPERVISOR
+    uint8_t supervisorFlags = superviseControlStep();
+  #else
+    uint8_t supervisorFlags = 0;
+  #endif
+  uint32_t now_us = micros();
+  applyPendingCommands();
+  bool fresh = false; // A new current reading arrived this tick
+  #if DUAL_CORE_ACQUISITION
+    AcquiredSample sample;
+    if (acquisitionMailbox.take(sample)) {
+      xTaskNotifyGive(acquisitionTaskHandle); // Start the next read now
+      fresh = true;
+      now_us = sample.timestamp_us;
+      busVoltage_V = sample.voltage_V;
+      current_mA = sample.current_mA;
+      if (sample.voltageFresh) complianceGuard.addVoltage(sample.timestamp_us, busVoltage_V);
+    } else {
+      staleControlTicks++; // Regulate on the previous sample
+    }
+  #elif ASYNC_ACQUISITION
+    fresh = collectAsyncSample(now_us); // Otherwise regulate on the previous sample
+  #else
+    // A failed read leaves the previous values in place.
+    if (sensorLink.isDegraded()) {
+      sensorLink.service(activeParams.maxCurrentLimit_mA);
+    } else {
+      fresh = sensorLink.readCurrent(current_mA);
+      if (fresh && sensorSchedule.voltageDue() && sensorLink.readBusVoltage(busVoltage_V)) {
+        sensorSchedule.voltageRead(busVoltage_V);
+        complianceGuard.addVoltage(now_us, busVoltage_V);
+      }
+    }
+  #endif
+  uint8_t sensorFlags = superviseSensorLink();
+
+  // Predictive guard: while the voltage is on course to hit the limit
+  // within the horizon, the PID may lower the output but not raise it past
+  // what is applied now. Narrowing the PID's output limits also clamps its
+  // integral, so the cap does not wind it up.
+  bool breachPredicted = complianceGuard.breachPredicted(now_us);
+  if (breachPredicted && !complianceCapped) {
+    myPID.SetOutputLimits(0, max(outputStage.getLastCode(), 1));
+    complianceCapped = true;
+    complianceCaps++;
+  } else if (!breachPredicted && complianceCapped) {
+    myPID.SetOutputLimits(0, 255);
+    complianceCapped = false;
+  }
+
+  int outputCode;
+  bool actuated = true; // The output written this tick reflects the applied commands
+  uint8_t flags = supervisorFlags | sensorFlags;
+  // Load faults: the output counts as limited while it is saturated,
+  // capped by the guard or held by an override on the previous tick. Only
+  // fresh readings from a healthy link are judged: a held reading from a
+  // sensor dropout would otherwise latch a fault that outlives the dropout.
+  bool outputLimited = outputStage.getLastCode() >= OPEN_CIRCUIT_OUTPUT_CODE || complianceCapped ||
+                       myPID.GetMode() == MANUAL;
+  bool faultRaised = false;
+  LoadFault fault = loadFaults.getFault();
+  if (fresh && !(sensorFlags & TELEMETRY_FLAG_SENSOR_FAULT)) {
+    fault = loadFaults.update(current_mA, busVoltage_V, complianceGuard.getSlope_VPerS(), outputLimited, faultRaised);
+  }
+  bool faultHold = fault != LOAD_FAULT_NONE && LOAD_FAULT_ACTION != LOAD_FAULT_ACTION_REPORT;
+  if (fault != LOAD_FAULT_NONE) flags |= TELEMETRY_FLAG_LOAD_FAULT;
+  if (faultRaised) logEvent(EVENT_LOAD_FAULT, fault, current_mA, busVoltage_V);
+  flags |= notifyAlarms(alarms.update(now_us, current_mA, busVoltage_V, activeParams.targetCurrent_mA,
+                                       activeParams.maxCurrentLimit_mA));
+  bool alarmHold = alarms.holdsSafeOutput();
+
+  Input = current_mA;
+  bool overCompliance = busVoltage_V >= MAXIMUM_BUS_VOLTAGE_INA219 && activeParams.targetCurrent_mA > current_mA;
+  bool sensorHold = sensorFlags & TELEMETRY_FLAG_SENSOR_FAULT; // Nothing to regulate on
+  if (overCompliance || faultHold || alarmHold || sensorHold) {
+    // Safety override is now platform-agnostic. The PID goes to MANUAL
+    // with its output tracking the override, so the integral cannot wind
+    // up and AUTOMATIC re-initialises from the applied output: bumpless.
+    bool minOutput = faultHold && !overCompliance && !alarmHold && !sensorHold && LOAD_FAULT_ACTION == LOAD_FAULT_ACTION_MIN_OUTPUT;
+    outputCode = outputStage.write(minOutput ? 1 : DAC_SAFETY_VALUE);
+    if (overCompliance) flags |= TELEMETRY_FLAG_SAFETY_OVERRIDE;
+    myPID.SetMode(MANUAL);
+    Output = outputCode;
+  } else {
+    myPID.SetMode(AUTOMATIC); // No-op unless leaving an override
+    pidClock_ms += PID_SAMPLE_TIME_MS;
+    actuated = myPID.ComputeAt(pidClock_ms);
+    outputCode = setOutputLevel(Output);
+  }
+  if (complianceCapped) flags |= TELEMETRY_FLAG_COMPLIANCE_CAP;
+  complianceRecovery.update(now_us, flags & TELEMETRY_FLAG_SAFETY_OVERRIDE, current_mA, activeParams.targetCurrent_mA);
+  logSafetyEpisode(flags & TELEMETRY_FLAG_SAFETY_OVERRIDE, busVoltage_V, current_mA, activeParams.targetCurrent_mA);
+
+  // Latency runs to the first tick whose output used the commands: the
+  // override's during a hold, otherwise the PID's once it has computed.
+  if (actuated) commandLatency.actuated(micros());
+
+  publishSample(now_us, outputCode, flags, fresh);
+}
+
+#if FAST_CONTROL
+// --- loop() side of the fast path: commands in, samples out ---
+void fastControlHousekeeping() {
+  applyPendingCommands();
+
+  FastControlSample sample;
+  while (fastControl.popSample(sample)) {
+    if (commandLatency.pending() > 0 && sample.paramsVersion == fastParamsVersion) {
+      commandLatency.actuated(sample.timestamp_us); // A tick has written an output with the new parameters
+    }
+    busVoltage_V = sample.voltage_V;
+    current_mA = sample.current_mA;
+    complianceRecovery.update(sample.timestamp_us, sample.flags & TELEMETRY_FLAG_SAFETY_OVERRIDE,
+                              sample.current_mA, sample.setpoint_mA);
+    logSafetyEpisode(sample.flags & TELEMETRY_FLAG_SAFETY_OVERRIDE, sample.voltage_V, sample.current_mA,
+                     sample.setpoint_mA);
+    // Alarms notify on the fast path but cannot hold its output.
+    uint8_t alarmFlag = notifyAlarms(alarms.update(sample.timestamp_us, sample.current_mA, sample.voltage_V,
+                                                   sample.setpoint_mA, activeParams.maxCurrentLimit_mA));
+    publishSample(sample.timestamp_us, sample.output, sample.flags | alarmFlag, sample.currentFresh);
+  }
+  logI2cErrors(fastControl.getI2cErrors());
+}
+#endif
+
 
 void setup() {
-  Serial.begin(115200);
+  #ifdef ESP32
+    Serial.setTxBufferSize(SERIAL_TX_BUFFER_SIZE); // Must precede begin()
+  #endif
+  Serial.begin(SERIAL_BAUD);
+  #if FLIGHT_RECORDER
+    // Before anything is logged, so the previous run's record is kept.
+    #ifdef ESP8266
+      flightRecorder.begin(nullptr);
+    #else
+      flightRecorder.begin(&flightMemory);
+    #endif
+    Serial.print("Reset reason: ");
+    Serial.println(resetReason());
+  #endif
   #ifdef ESP8266
     // For ESP8266, the dacWrite wrapper in util.h handles analogWrite setup.
     // If specific setup like pinMode is needed, it should be in the wrapper.
   #endif
-  Wire.begin();
+  sensorLink.begin(I2C_SDA_PIN, I2C_SCL_PIN, INA219_I2C_CLOCK_HZ);
 
-  if (!ina219.begin()) {
-    Serial.println("Failed to find INA219 chip");
-    while (1) { delay(10); }
-  }
-
-  if (!ina219.setMaxCurrentShunt(maxCurrentLimit_mA / 1000.0, SHUNT_RESISTOR_OHMS)) {
-    Serial.println("INA219 calibration failed.");
-    while (1) { delay(10); }
+  // A missing sensor no longer stops the boot: the control step holds the
+  // safe output and keeps trying to bring it back, and the web interface
+  // stays reachable to say so.
+  if (!ina219.begin() || !ina219.setMaxCurrentShunt(activeParams.maxCurrentLimit_mA / 1000.0, SHUNT_RESISTOR_OHMS)) {
+    Serial.println("INA219 not responding, holding the safe output until it recovers.");
+    sensorLink.degrade();
+  } else {
+    Serial.println("INA219 calibrated successfully.");
+    // Both channels convert continuously, with a short bus conversion: the
+    // bus voltage is only read every few ticks, so shunt-only mode would
+    // leave it stale, but its conversion should not stretch the cycle.
+    if (!ina219.setShuntADC(INA219_SHUNT_ADC) || !ina219.setBusADC(INA219_BUS_ADC) ||
+        !ina219.setModeShuntBusContinuous()) {
+      Serial.println("INA219 ADC configuration failed, using defaults.");
+    }
   }
-  Serial.println("INA219 calibrated successfully.");
+  sensorSchedule.begin(CONTROL_VOLTAGE_DECIMATION, MAXIMUM_BUS_VOLTAGE_INA219, COMPLIANCE_GUARD_MARGIN_V);
+  complianceGuard.begin(MAXIMUM_BUS_VOLTAGE_INA219, COMPLIANCE_PREDICT_PERIODS * CONTROL_PERIOD_US);
+  loadFaults.begin({LOAD_FAULT_CONFIRM_TICKS, OPEN_CIRCUIT_CURRENT_MA, OPEN_CIRCUIT_VOLTAGE_V,
+                    SHORT_CIRCUIT_CURRENT_MA, SHORT_CIRCUIT_VOLTAGE_V});
+  alarms.begin(alarmRules, sizeof(alarmRules) / sizeof(alarmRules[0]));
+  #if ALARM_GPIO_PIN >= 0
+    pinMode(ALARM_GPIO_PIN, OUTPUT);
+    digitalWrite(ALARM_GPIO_PIN, LOW);
+  #endif
+  logEvent(EVENT_BOOT, 0, activeParams.maxCurrentLimit_mA, activeParams.targetCurrent_mA);
 
   setOutputLevel(0);
 
@@ -137,33 +1444,97 @@ void setup() {
   Serial.print("IP address: ");
   Serial.println(WiFi.localIP());
 
+  // Seeded once the radio is up, so the hardware RNG is a true entropy
+  // source: ETags from a previous boot must not match this one's.
+  #ifdef ESP8266
+    uint32_t bootNonce = RANDOM_REG32;
+  #else
+    uint32_t bootNonce = esp_random();
+  #endif
+  jsonSnapshot.begin(bootNonce);
+  binarySnapshot.begin(bootNonce);
+  cborSnapshot.begin(bootNonce);
+
   server.on("/", HTTP_GET, handleRoot);
   server.on("/data", HTTP_GET, handleData); // New endpoint for data
   server.on("/set", HTTP_GET, handleSet);
   server.on("/setpid", HTTP_GET, handleSetPid);
   server.on("/setadvanced", HTTP_GET, handleSetAdvanced);
+  server.on("/latency", HTTP_GET, handleLatency);
+  server.on("/sched", HTTP_GET, handleSchedulerStats);
+  server.on("/events", HTTP_GET, handleEvents);
+  server.on("/alarms", HTTP_GET, handleAlarms);
+  #if FLIGHT_RECORDER
+    server.on("/flight", HTTP_GET, handleFlightRecord);
+  #endif
+
+  const char *collectedHeaders[] = {"If-None-Match", "Accept"};
+  server.collectHeaders(collectedHeaders, sizeof(collectedHeaders) / sizeof(collectedHeaders[0]));
   
   server.begin();
   Serial.println("HTTP server started");
 
-  Setpoint = targetCurrent_mA;
+  scpiServer.begin();
+  scpiServer.setNoDelay(true);
+  Serial.print("SCPI server listening on port ");
+  Serial.println(SCPI_TCP_PORT);
+
+  udpTelemetry.begin(IPAddress(UDP_STREAM_GROUP), UDP_STREAM_PORT);
+  udpTelemetry.configure(UDP_STREAM_DECIMATION, UDP_STREAM_BATCH);
+  udpTelemetry.setEnabled(UDP_STREAM_ON_BOOT);
+
+  deltaPublisher.setDeadbands(LONGPOLL_DEADBAND_MA, LONGPOLL_DEADBAND_V);
+
+  Setpoint = activeParams.targetCurrent_mA;
+  paramBlock.write(activeParams);
+
+  scheduler.begin(CONTROL_PERIOD_US, WEB_BUDGET_US, CONTROL_LATE_TOLERANCE_US);
   myPID.SetMode(AUTOMATIC);
   // Set PID output limits to a standard 8-bit range for both platforms.
   myPID.SetOutputLimits(0, 255);
+  // The default 100 ms sample time would scale Ki and Kd for a step fifty
+  // times longer than the real one. Ki and Kd are per second, so the
+  // tuning keeps its meaning at the control step rate.
+  myPID.SetSampleTime(PID_SAMPLE_TIME_MS);
+
+  #if DUAL_CORE_ACQUISITION
+    // loop() runs on core 1; the acquisition task gets core 0 with WiFi.
+    xTaskCreatePinnedToCore(acquisitionTask, "acquisition", 4096, nullptr, ACQUISITION_TASK_PRIORITY,
+                            &acquisitionTaskHandle, 0);
+  #endif
+
+  #if ASYNC_ACQUISITION
+    asyncI2c.begin(Wire, ACQUISITION_TASK_PRIORITY, 0);
+  #endif
+
+  #if FAST_CONTROL
+    // From here on fastControl owns the I2C pins; Wire and ina219 are not used.
+    WiFi.persistent(false); // No flash writes while the fast path runs
+    FastControlParams fastParams = {++fastParamsVersion, (float)activeParams.targetCurrent_mA,
+                                  (float)activeParams.kp, (float)activeParams.ki, (float)activeParams.kd, 0, 0};
+    ina219Calibration(activeParams.maxCurrentLimit_mA / 1000.0, SHUNT_RESISTOR_OHMS,
+                      fastParams.calibration, fastParams.currentLsb_mA);
+    fastControl.begin(CONTROL_PERIOD_US, fastParams);
+    Serial.println("Fast control path enabled");
+  #endif
+
+  #if WATCHDOG_SUPERVISOR
+    // Last, so the long setup steps above are not counted as stalls.
+    if (!controlWatchdog.begin(WATCHDOG_STALL_US, WATCHDOG_DEADLINE_US, WATCHDOG_CHECK_US, WATCHDOG_SAFE_CODE)) {
+      Serial.println("Control watchdog could not start.");
+    }
+  #endif
 }
 
 void loop() {
-  server.handleClient();
+  serviceControl();
 
-  busVoltage_V = ina219.getBusVoltage();
-  current_mA = ina219.getCurrent_mA();
-
-  if (busVoltage_V >= MAXIMUM_BUS_VOLTAGE_INA219 && targetCurrent_mA > current_mA) {
-    // Safety override is now platform-agnostic.
-    dacWrite(DAC_PIN, DAC_SAFETY_VALUE);
-  } else {
-    Input = current_mA;
-    myPID.Compute();
-    setOutputLevel(Output);
+  // Web and SCPI work only runs in the slack between control steps.
+  if (scheduler.beginWebSlice()) {
+    server.handleClient();
+    handleScpi();
+    udpTelemetry.send();
+    logWifiChanges();
+    scheduler.endWebSlice();
   }
 }
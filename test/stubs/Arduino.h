@@ -0,0 +1,33 @@
+#pragma once
+
+// Arduino.h (native test stub)
+//
+// Just enough of the Arduino core for host-side tests of header-only
+// modules. Time only moves when a test sets fakeArduino.now_ms, and a pin
+// listed in fakeArduino.stuckLowPin reads LOW, as a slave holding SDA
+// would.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+struct FakeArduino {
+  uint32_t now_ms = 0;
+  int stuckLowPin = -1;
+};
+
+inline FakeArduino fakeArduino;
+
+inline unsigned long millis() { return fakeArduino.now_ms; }
+inline unsigned long micros() { return fakeArduino.now_ms * 1000UL; }
+inline void delayMicroseconds(unsigned int) {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t pin) { return pin == fakeArduino.stuckLowPin ? LOW : HIGH; }
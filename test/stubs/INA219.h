@@ -0,0 +1,27 @@
+#pragma once
+
+// INA219.h (native test stub)
+//
+// The subset of the robtillaart INA219 API that ina219_link.h uses. Every
+// register write succeeds or fails with the fake bus it is attached to.
+
+#include <Wire.h>
+
+class INA219 {
+public:
+  INA219(uint8_t, TwoWire *wire = &Wire) : wire(wire) {}
+
+  bool setMaxCurrentShunt(float maxCurrent = 3.4, float = 0.002) {
+    if (wire->failing) return false;
+    currentLSB_mA = maxCurrent * 1000.0f / 32768;
+    return true;
+  }
+  bool setShuntADC(uint8_t = 0x03) { return !wire->failing; }
+  bool setBusADC(uint8_t = 0x03) { return !wire->failing; }
+  bool setModeShuntBusContinuous() { return !wire->failing; }
+  float getCurrentLSB_mA() { return currentLSB_mA; }
+
+private:
+  TwoWire *wire;
+  float currentLSB_mA = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+// Wire.h (native test stub)
+//
+// A fake I2C bus. While `failing` is set every transaction ends with
+// `error`, as a missing or wedged device would; otherwise register reads
+// return `registerValue`.
+
+#include <Arduino.h>
+
+class TwoWire {
+public:
+  bool begin(int = -1, int = -1) {
+    starts++;
+    return true;
+  }
+  void end() {}
+  void setClock(uint32_t) {}
+  void setTimeOut(uint16_t timeout_ms) { this->timeout_ms = timeout_ms; }
+  void setClockStretchLimit(uint32_t) {}
+
+  void beginTransmission(uint8_t) {}
+  size_t write(uint8_t) { return 1; }
+  uint8_t endTransmission(bool = true) { return failing ? error : 0; }
+  uint8_t requestFrom(uint8_t, uint8_t count) {
+    if (failing) return 0;
+    readIndex = 0;
+    return count;
+  }
+  int read() { return readIndex++ == 0 ? registerValue >> 8 : registerValue & 0xFF; }
+
+  bool failing = false;
+  uint8_t error = 2; // NACK on address
+  uint16_t registerValue = 0;
+  uint16_t timeout_ms = 0;
+  uint32_t starts = 0;
+
+private:
+  uint8_t readIndex = 0;
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,98 @@
+// Host-side checks for command_queue.h: run with `pio test -e native`.
+//
+// The control step drains the queue with drainCommands() on every tick,
+// and only some ticks act on what it applied. These tests run that loop
+// through long safety holds, where no tick ever acts on the commands.
+
+#include <unity.h>
+#include "command_queue.h"
+#include "load_faults.h"
+
+#define QUEUE_DEPTH 16
+
+struct Command {
+  uint8_t type; // 0: set, 1: clear the load fault
+  uint32_t arrival_us;
+  float value;
+};
+
+static MpscQueue<Command, QUEUE_DEPTH> queue;
+static ActuationLatency<QUEUE_DEPTH> latency;
+static LoadFaultDetector faults;
+static float setpoint;
+
+// One control tick during a hold: drains the queue, never actuates.
+static uint32_t holdTick(uint32_t now_us) {
+  return drainCommands(queue, latency, now_us, [](const Command &command) {
+    if (command.type == 0) setpoint = command.value;
+    else faults.clear();
+  });
+}
+
+static void latchOpenFault() {
+  faults.begin({2, 1.0f, 10.0f, 5.0f, 0.5f});
+  bool raised;
+  faults.update(0, 12, 0, true, raised);
+  faults.update(0, 12, 0, true, raised);
+  TEST_ASSERT_EQUAL(LOAD_FAULT_OPEN, faults.getFault());
+}
+
+void setUp() {
+  Command leftover;
+  while (queue.pop(leftover)) {}
+  latency = ActuationLatency<QUEUE_DEPTH>();
+  setpoint = 0;
+}
+
+void tearDown() {}
+
+void test_a_fault_clears_after_more_commands_than_the_queue_holds() {
+  latchOpenFault();
+  uint32_t now_us = 0;
+  for (uint32_t i = 1; i <= 3 * QUEUE_DEPTH; i++) {
+    now_us += 1000;
+    TEST_ASSERT_TRUE(queue.push({0, now_us, (float)i}));
+    TEST_ASSERT_EQUAL_UINT32(1, holdTick(now_us + 500));
+  }
+  TEST_ASSERT_EQUAL_FLOAT(3 * QUEUE_DEPTH, setpoint);
+
+  TEST_ASSERT_TRUE(queue.push({1, now_us, 0}));
+  TEST_ASSERT_EQUAL_UINT32(1, holdTick(now_us + 500));
+  TEST_ASSERT_EQUAL(LOAD_FAULT_NONE, faults.getFault());
+}
+
+void test_a_full_queue_drains_in_one_tick() {
+  latchOpenFault();
+  for (uint32_t i = 0; i < QUEUE_DEPTH - 1; i++) TEST_ASSERT_TRUE(queue.push({0, 0, (float)i}));
+  TEST_ASSERT_TRUE(queue.push({1, 0, 0}));
+  TEST_ASSERT_FALSE(queue.push({0, 0, 0}));
+
+  TEST_ASSERT_EQUAL_UINT32(QUEUE_DEPTH, holdTick(100));
+  TEST_ASSERT_EQUAL(LOAD_FAULT_NONE, faults.getFault());
+  TEST_ASSERT_TRUE(queue.push({0, 0, 0}));
+}
+
+void test_stamps_that_do_not_fit_are_recorded_when_applied() {
+  for (uint32_t i = 0; i < QUEUE_DEPTH + 4; i++) {
+    queue.push({0, 1000 * i, 0});
+    holdTick(1000 * i + 300);
+  }
+  TEST_ASSERT_EQUAL_UINT8(QUEUE_DEPTH, latency.pending());
+  LatencyStats stats = latency.stats();
+  TEST_ASSERT_EQUAL_UINT32(4, stats.count);
+  TEST_ASSERT_EQUAL_UINT32(300, stats.max_us);
+
+  latency.actuated(1000 * QUEUE_DEPTH + 10000);
+  TEST_ASSERT_EQUAL_UINT8(0, latency.pending());
+  stats = latency.stats();
+  TEST_ASSERT_EQUAL_UINT32(QUEUE_DEPTH + 4, stats.count);
+  TEST_ASSERT_EQUAL_UINT32(1000 * QUEUE_DEPTH + 10000, stats.max_us); // The first command, held the longest
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_a_fault_clears_after_more_commands_than_the_queue_holds);
+  RUN_TEST(test_a_full_queue_drains_in_one_tick);
+  RUN_TEST(test_stamps_that_do_not_fit_are_recorded_when_applied);
+  return UNITY_END();
+}
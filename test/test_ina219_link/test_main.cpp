@@ -0,0 +1,202 @@
+// Host-side checks for ina219_link.h: run with `pio test -e native`.
+//
+// A fake bus (test/stubs) stands in for Wire and the INA219 library, and
+// time only moves when the test advances it, so detection, back-off and
+// each recovery stage can be followed call by call.
+
+#include <unity.h>
+#include "ina219_link.h"
+
+#define SDA_PIN 21
+#define SCL_PIN 22
+#define MAX_CURRENT_MA 500.0
+
+static TwoWire bus;
+static INA219 sensor(INA219_ADDRESS, &bus);
+
+static void advance(uint32_t ms) { fakeArduino.now_ms += ms; }
+
+// Calls service() once per millisecond until the attempt counter moves or
+// limit_ms passes. Returns the time waited.
+static uint32_t waitForAttempt(Ina219Link &link, uint32_t limit_ms) {
+  uint32_t attempts = link.getAttempts();
+  for (uint32_t waited = 0; waited <= limit_ms; waited++) {
+    link.service(MAX_CURRENT_MA);
+    if (link.getAttempts() != attempts) return waited;
+    advance(1);
+  }
+  return UINT32_MAX;
+}
+
+void setUp() {
+  fakeArduino = FakeArduino();
+  fakeArduino.now_ms = 1000;
+  bus = TwoWire();
+  sensor.setMaxCurrentShunt(MAX_CURRENT_MA / 1000.0, SHUNT_RESISTOR_OHMS);
+}
+
+void tearDown() {}
+
+void test_begin_sets_the_transaction_timeout() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  TEST_ASSERT_EQUAL_UINT32(I2C_TIMEOUT_MS, bus.timeout_ms);
+}
+
+void test_reads_convert_with_the_calibrated_lsb() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  bus.registerValue = 1000;
+  float current_mA = 0;
+  TEST_ASSERT_TRUE(link.readCurrent(current_mA));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 1000 * sensor.getCurrentLSB_mA(), current_mA);
+
+  bus.registerValue = 1250 << 3; // 5.0 V
+  float voltage_V = 0;
+  TEST_ASSERT_TRUE(link.readBusVoltage(voltage_V));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 5.0, voltage_V);
+}
+
+void test_degrades_after_threshold_consecutive_failures() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  bus.failing = true;
+  bus.error = 3;
+  float current_mA = 42;
+  for (uint8_t i = 1; i < I2C_FAULT_THRESHOLD; i++) {
+    TEST_ASSERT_FALSE(link.readCurrent(current_mA));
+    TEST_ASSERT_FALSE(link.isDegraded());
+  }
+  TEST_ASSERT_FALSE(link.readCurrent(current_mA));
+  TEST_ASSERT_TRUE(link.isDegraded());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 42, current_mA); // Failed reads leave the value alone
+  TEST_ASSERT_EQUAL_UINT32(I2C_FAULT_THRESHOLD, link.getErrors());
+  TEST_ASSERT_EQUAL_UINT32(1, link.getDegradations());
+  TEST_ASSERT_EQUAL_UINT8(3, link.getLastError());
+}
+
+void test_a_good_read_resets_the_failure_count() {
+  Ina219Link link(sensor, bus);
+  for (uint8_t round = 0; round < 3; round++) {
+    for (uint8_t i = 1; i < I2C_FAULT_THRESHOLD; i++) TEST_ASSERT_FALSE(link.report(false, 2));
+    TEST_ASSERT_TRUE(link.report(true));
+  }
+  TEST_ASSERT_FALSE(link.isDegraded());
+  TEST_ASSERT_EQUAL_UINT32(3 * (I2C_FAULT_THRESHOLD - 1), link.getErrors());
+}
+
+void test_service_does_nothing_while_healthy() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  uint32_t starts = bus.starts;
+  TEST_ASSERT_FALSE(link.service(MAX_CURRENT_MA));
+  TEST_ASSERT_EQUAL_UINT32(0, link.getAttempts());
+  TEST_ASSERT_EQUAL_UINT32(starts, bus.starts);
+}
+
+void test_recovery_backs_off_while_sda_is_held_low() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  bus.failing = true;
+  fakeArduino.stuckLowPin = SDA_PIN;
+  link.degrade();
+
+  TEST_ASSERT_EQUAL_UINT32(I2C_RETRY_MIN_MS, waitForAttempt(link, 10000));
+  uint32_t expected = I2C_RETRY_MIN_MS;
+  for (uint8_t i = 0; i < 12; i++) {
+    expected = expected * 2 < I2C_RETRY_MAX_MS ? expected * 2 : I2C_RETRY_MAX_MS;
+    advance(1);
+    TEST_ASSERT_EQUAL_UINT32(expected - 1, waitForAttempt(link, 10000));
+  }
+  TEST_ASSERT_EQUAL_UINT32(I2C_RETRY_MAX_MS, expected);
+  TEST_ASSERT_TRUE(link.isDegraded());
+  TEST_ASSERT_EQUAL_UINT32(0, link.getRecoveries());
+}
+
+void test_failed_stage_restarts_from_bus_clear() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  bus.failing = true; // Bus clear succeeds, then calibration is NACKed
+  link.degrade();
+
+  waitForAttempt(link, 100);
+  uint32_t starts = bus.starts;
+  advance(1);
+  TEST_ASSERT_FALSE(link.service(MAX_CURRENT_MA)); // Calibrate fails
+  TEST_ASSERT_EQUAL_UINT32(starts, bus.starts);
+  TEST_ASSERT_EQUAL_UINT32(1, link.getAttempts());
+
+  advance(1);
+  TEST_ASSERT_FALSE(link.service(MAX_CURRENT_MA)); // Backing off: nothing runs
+  TEST_ASSERT_EQUAL_UINT32(starts, bus.starts);
+  TEST_ASSERT_EQUAL_UINT32(2 * I2C_RETRY_MIN_MS - 1, waitForAttempt(link, 100)); // Doubled from the failure
+  TEST_ASSERT_EQUAL_UINT32(starts + 1, bus.starts); // Bus cleared and Wire restarted
+}
+
+void test_recovers_one_stage_per_call_once_the_bus_returns() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  bus.failing = true;
+  float current_mA;
+  for (uint8_t i = 0; i < I2C_FAULT_THRESHOLD; i++) link.readCurrent(current_mA);
+  TEST_ASSERT_TRUE(link.isDegraded());
+
+  // Two failed attempts while the device is still missing.
+  waitForAttempt(link, 10000);
+  advance(1);
+  waitForAttempt(link, 10000);
+  advance(1);
+  link.service(MAX_CURRENT_MA);
+  TEST_ASSERT_EQUAL_UINT32(2, link.getAttempts());
+
+  bus.failing = false;
+  waitForAttempt(link, 10000); // Bus clear
+  TEST_ASSERT_TRUE(link.isDegraded());
+  TEST_ASSERT_FALSE(link.service(MAX_CURRENT_MA)); // Calibrate
+  TEST_ASSERT_FALSE(link.service(MAX_CURRENT_MA)); // Configure
+  TEST_ASSERT_TRUE(link.isDegraded());
+  TEST_ASSERT_TRUE(link.service(MAX_CURRENT_MA)); // Probe
+  TEST_ASSERT_FALSE(link.isDegraded());
+  TEST_ASSERT_EQUAL_UINT32(3, link.getAttempts());
+  TEST_ASSERT_EQUAL_UINT32(1, link.getRecoveries());
+
+  bus.registerValue = 100;
+  TEST_ASSERT_TRUE(link.readCurrent(current_mA));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100 * sensor.getCurrentLSB_mA(), current_mA);
+}
+
+void test_back_off_starts_over_after_a_recovery() {
+  Ina219Link link(sensor, bus);
+  link.begin(SDA_PIN, SCL_PIN, 400000);
+  fakeArduino.stuckLowPin = SDA_PIN;
+  link.degrade();
+  for (uint8_t i = 0; i < 5; i++) {
+    waitForAttempt(link, 10000);
+    advance(1);
+  }
+
+  fakeArduino.stuckLowPin = -1;
+  waitForAttempt(link, 10000); // Bus clear
+  bool restored = false;
+  for (uint8_t stage = 0; stage < 3 && !restored; stage++) restored = link.service(MAX_CURRENT_MA);
+  TEST_ASSERT_TRUE(restored);
+
+  for (uint8_t i = 0; i < I2C_FAULT_THRESHOLD; i++) link.report(false, 2);
+  TEST_ASSERT_TRUE(link.isDegraded());
+  TEST_ASSERT_EQUAL_UINT32(2, link.getDegradations());
+  TEST_ASSERT_EQUAL_UINT32(I2C_RETRY_MIN_MS, waitForAttempt(link, 10000));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_sets_the_transaction_timeout);
+  RUN_TEST(test_reads_convert_with_the_calibrated_lsb);
+  RUN_TEST(test_degrades_after_threshold_consecutive_failures);
+  RUN_TEST(test_a_good_read_resets_the_failure_count);
+  RUN_TEST(test_service_does_nothing_while_healthy);
+  RUN_TEST(test_recovery_backs_off_while_sda_is_held_low);
+  RUN_TEST(test_failed_stage_restarts_from_bus_clear);
+  RUN_TEST(test_recovers_one_stage_per_call_once_the_bus_returns);
+  RUN_TEST(test_back_off_starts_over_after_a_recovery);
+  return UNITY_END();
+}
@@ -0,0 +1,161 @@
+// Host-side checks for seqlock.h: run with `pio test -e native`.
+//
+// The stress tests run writer threads against several reader threads.
+// Every block a writer publishes has all its words set to the same value,
+// so a reader that ever sees two different words has a torn snapshot. The
+// multi-writer case serializes its writers with a mutex, as seqlock.h
+// requires.
+
+#include <unity.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "seqlock.h"
+
+#define STRESS_WRITES 2000000
+#define STRESS_READERS 3
+#define STRESS_WRITERS 3
+#define WRITER_SHIFT 24 // Block value: writer index above, that writer's count below
+
+struct Block {
+  uint32_t words[16];
+};
+
+static Block blockOf(uint32_t value) {
+  Block block;
+  for (uint32_t &word : block.words) word = value;
+  return block;
+}
+
+static bool consistent(const Block &block) {
+  for (uint32_t word : block.words) {
+    if (word != block.words[0]) return false;
+  }
+  return true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_read_returns_last_write() {
+  SeqLock<Block> lock;
+  Block out = blockOf(0);
+  TEST_ASSERT_TRUE(lock.tryRead(out));
+  TEST_ASSERT_EQUAL_UINT32(0, out.words[0]);
+
+  lock.write(blockOf(7));
+  uint32_t version = 0;
+  TEST_ASSERT_TRUE(lock.tryRead(out, &version));
+  TEST_ASSERT_EQUAL_UINT32(7, out.words[15]);
+  TEST_ASSERT_EQUAL_UINT32(lock.version(), version);
+}
+
+void test_version_advances_by_two_per_write() {
+  SeqLock<Block> lock;
+  uint32_t start = lock.version();
+  lock.write(blockOf(1));
+  lock.write(blockOf(2));
+  TEST_ASSERT_EQUAL_UINT32(start + 4, lock.version());
+  TEST_ASSERT_EQUAL_UINT32(0, lock.version() & 1);
+}
+
+void test_concurrent_readers_never_see_torn_snapshots() {
+  SeqLock<Block> lock;
+  std::atomic<bool> done{false};
+  std::atomic<uint32_t> torn{0};
+  std::atomic<uint32_t> regressions{0};
+  std::atomic<uint64_t> reads{0};
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < STRESS_READERS; r++) {
+    readers.emplace_back([&]() {
+      Block out = blockOf(0);
+      uint32_t lastValue = 0;
+      uint64_t ok = 0;
+      while (!done.load(std::memory_order_acquire)) {
+        if (!lock.tryRead(out)) continue;
+        ok++;
+        if (!consistent(out)) torn++;
+        if (out.words[0] < lastValue) regressions++; // Snapshots must not go back in time
+        lastValue = out.words[0];
+      }
+      reads += ok;
+    });
+  }
+
+  std::thread writer([&]() {
+    for (uint32_t value = 1; value <= STRESS_WRITES; value++) lock.write(blockOf(value));
+    done.store(true, std::memory_order_release);
+  });
+
+  writer.join();
+  for (std::thread &reader : readers) reader.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+  TEST_ASSERT_EQUAL_UINT32(0, regressions.load());
+  TEST_ASSERT_TRUE(reads.load() > 0);
+  Block last = blockOf(0);
+  TEST_ASSERT_TRUE(lock.tryRead(last));
+  TEST_ASSERT_EQUAL_UINT32(STRESS_WRITES, last.words[0]);
+}
+
+void test_serialized_writers_never_tear_snapshots() {
+  SeqLock<Block> lock;
+  std::mutex writeMutex;
+  std::atomic<int> writersLeft{STRESS_WRITERS};
+  std::atomic<uint32_t> torn{0};
+  std::atomic<uint32_t> regressions{0};
+  std::atomic<uint64_t> reads{0};
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < STRESS_READERS; r++) {
+    readers.emplace_back([&]() {
+      Block out = blockOf(0);
+      uint32_t lastCount[STRESS_WRITERS + 1] = {};
+      uint64_t ok = 0;
+      while (writersLeft.load(std::memory_order_acquire) > 0) {
+        if (!lock.tryRead(out)) continue;
+        ok++;
+        if (!consistent(out)) torn++;
+        uint32_t writer = out.words[0] >> WRITER_SHIFT;
+        uint32_t count = out.words[0] & ((1u << WRITER_SHIFT) - 1);
+        if (writer > STRESS_WRITERS) {
+          torn++;
+          continue;
+        }
+        if (count < lastCount[writer]) regressions++; // Each writer's blocks must appear in order
+        lastCount[writer] = count;
+      }
+      reads += ok;
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (uint32_t w = 1; w <= STRESS_WRITERS; w++) {
+    writers.emplace_back([&, w]() {
+      for (uint32_t count = 1; count <= STRESS_WRITES / STRESS_WRITERS; count++) {
+        std::lock_guard<std::mutex> guard(writeMutex);
+        lock.write(blockOf(w << WRITER_SHIFT | count));
+      }
+      writersLeft--;
+    });
+  }
+
+  for (std::thread &writer : writers) writer.join();
+  for (std::thread &reader : readers) reader.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+  TEST_ASSERT_EQUAL_UINT32(0, regressions.load());
+  TEST_ASSERT_TRUE(reads.load() > 0);
+  TEST_ASSERT_EQUAL_UINT32(2 * (STRESS_WRITES / STRESS_WRITERS) * STRESS_WRITERS, lock.version());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_read_returns_last_write);
+  RUN_TEST(test_version_advances_by_two_per_write);
+  RUN_TEST(test_concurrent_readers_never_see_torn_snapshots);
+  RUN_TEST(test_serialized_writers_never_tear_snapshots);
+  return UNITY_END();
+}
@@ -0,0 +1,161 @@
+// pid_bench.cpp
+//
+// Host-side check and microbenchmark for FloatPID (include/float_pid.h).
+// Replays a recorded trace through BasicPID<double>, which reproduces
+// PID_v1's arithmetic, and through FloatPID. It reports the largest output
+// difference, how many steps would have written a different output code,
+// and the time per Compute for each variant.
+//
+// The trace is the CSV written by telemetry_decoder. The recorded current
+// is fed as the input and the recorded setpoint as the setpoint, one step
+// per row. Without a trace a simulated step response is used.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I../include pid_bench.cpp -o pid_bench
+//
+// Usage:
+//   pid_bench samples.csv [-k kp,ki,kd] [-s sample_ms] [-t tolerance]
+//   pid_bench --synthetic [-k kp,ki,kd]
+//
+// Exits with status 1 if any output differs by more than the tolerance
+// (default 0.5, i.e. half an output code).
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "float_pid.h"
+
+struct TracePoint {
+  float current_mA;
+  float setpoint_mA;
+};
+
+// Reads the current_mA and setpoint_mA columns of a telemetry_decoder CSV.
+static bool loadTrace(const char *path, std::vector<TracePoint> &trace) {
+  FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (in == nullptr) return false;
+  char line[256];
+  int currentCol = -1, setpointCol = -1;
+  if (fgets(line, sizeof(line), in) != nullptr) {
+    int col = 0;
+    for (char *field = strtok(line, ",\r\n"); field != nullptr; field = strtok(nullptr, ",\r\n"), col++) {
+      if (strcmp(field, "current_mA") == 0) currentCol = col;
+      if (strcmp(field, "setpoint_mA") == 0) setpointCol = col;
+    }
+  }
+  if (currentCol < 0 || setpointCol < 0) {
+    if (in != stdin) fclose(in);
+    return false;
+  }
+  while (fgets(line, sizeof(line), in) != nullptr) {
+    TracePoint point = {0, 0};
+    int col = 0;
+    for (char *field = strtok(line, ",\r\n"); field != nullptr; field = strtok(nullptr, ",\r\n"), col++) {
+      if (col == currentCol) point.current_mA = strtof(field, nullptr);
+      if (col == setpointCol) point.setpoint_mA = strtof(field, nullptr);
+    }
+    trace.push_back(point);
+  }
+  if (in != stdin) fclose(in);
+  return true;
+}
+
+// First-order plant driven by the double controller, as in the on-device
+// SYSTem:PID:BENChmark? query.
+static void synthesizeTrace(std::vector<TracePoint> &trace, double kp, double ki, double kd) {
+  double in = 0, out = 0, set = 100;
+  BasicPID<double> pid(&in, &out, &set, kp, ki, kd, DIRECT);
+  pid.SetMode(AUTOMATIC);
+  for (unsigned long i = 0; i < 5000; i++) {
+    if (i == 2500) set = 250;
+    pid.ComputeAt(i * 100);
+    trace.push_back({(float)in, (float)set});
+    in += (out * 500.0 / 255.0 - in) * 0.2;
+  }
+}
+
+template <typename Real>
+static double timeCompute(const std::vector<TracePoint> &trace, double kp, double ki, double kd,
+                          unsigned long sample_ms, std::vector<Real> &outputs) {
+  Real in = 0, out = 0, set = 0;
+  BasicPID<Real> pid(&in, &out, &set, (Real)kp, (Real)ki, (Real)kd, DIRECT);
+  pid.SetSampleTime((int)sample_ms);
+  pid.SetMode(AUTOMATIC);
+  outputs.resize(trace.size());
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < trace.size(); i++) {
+    in = (Real)trace[i].current_mA;
+    set = (Real)trace[i].setpoint_mA;
+    pid.ComputeAt(i * sample_ms);
+    outputs[i] = out;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / trace.size();
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  bool synthetic = false;
+  double kp = 20.0, ki = 5.0, kd = 1.0; // config.h defaults
+  unsigned long sample_ms = 100;
+  double tolerance = 0.5;
+  bool badArgs = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%lf,%lf,%lf", &kp, &ki, &kd) != 3) badArgs = true;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      sample_ms = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      tolerance = strtod(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--synthetic") == 0) {
+      synthetic = true;
+    } else if (input == nullptr) {
+      input = argv[i];
+    }
+  }
+  if (badArgs || (input == nullptr) == !synthetic || sample_ms == 0) {
+    fprintf(stderr, "usage: %s <samples.csv|-> [-k kp,ki,kd] [-s sample_ms] [-t tolerance]\n"
+                    "       %s --synthetic [-k kp,ki,kd]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  std::vector<TracePoint> trace;
+  if (synthetic) {
+    synthesizeTrace(trace, kp, ki, kd);
+  } else if (!loadTrace(input, trace)) {
+    fprintf(stderr, "Cannot read a current_mA/setpoint_mA trace from %s\n", input);
+    return 1;
+  }
+  if (trace.empty()) {
+    fprintf(stderr, "Empty trace\n");
+    return 1;
+  }
+
+  // Several passes so the timings are not dominated by the first one.
+  std::vector<double> reference;
+  std::vector<float> candidate;
+  double doubleNs = 1e9, floatNs = 1e9;
+  for (int pass = 0; pass < 5; pass++) {
+    doubleNs = fmin(doubleNs, timeCompute(trace, kp, ki, kd, sample_ms, reference));
+    floatNs = fmin(floatNs, timeCompute(trace, kp, ki, kd, sample_ms, candidate));
+  }
+
+  double maxDiff = 0;
+  size_t codeMismatches = 0;
+  for (size_t i = 0; i < trace.size(); i++) {
+    maxDiff = fmax(maxDiff, fabs(reference[i] - (double)candidate[i]));
+    // setOutputLevel() truncates to an integer code.
+    if ((int)reference[i] != (int)candidate[i]) codeMismatches++;
+  }
+
+  printf("steps=%zu double_ns=%.2f float_ns=%.2f max_diff=%.6g code_mismatches=%zu\n",
+         trace.size(), doubleNs, floatNs, maxDiff, codeMismatches);
+  return maxDiff <= tolerance ? 0 : 1;
+}
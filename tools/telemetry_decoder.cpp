@@ -0,0 +1,234 @@
+// telemetry_decoder.cpp
+//
+// Host-side decoder for the firmware's binary telemetry streams (see
+// include/telemetry_frame.h). Reads COBS frames from a serial port or a
+// capture file, or raw frames from the UDP multicast stream, and writes
+// one CSV row per control sample.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I../include telemetry_decoder.cpp -o telemetry_decoder
+//
+// Usage:
+//   telemetry_decoder /dev/ttyUSB0 [-b 921600] [-o samples.csv]
+//   telemetry_decoder capture.bin -o samples.csv
+//   telemetry_decoder -u 5026 [-g 239.255.50.25] [-o samples.csv]
+//
+// Streaming is switched on from the device with "SYST:STR ON" (serial) or
+// "SYST:UDP ON" (multicast).
+
+#include <errno.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "telemetry_frame.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) { stopRequested = 1; }
+
+static speed_t baudToSpeed(long baud) {
+  switch (baud) {
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+#ifdef B1500000
+    case 1500000: return B1500000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+    default: return 0;
+  }
+}
+
+static bool configureSerial(int fd, long baud) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) return false; // Not a tty: plain capture file.
+  speed_t speed = baudToSpeed(baud);
+  if (speed == 0) {
+    fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+static int openMulticast(const char *group, int port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons((uint16_t)port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  struct ip_mreq mreq;
+  mreq.imr_multiaddr.s_addr = inet_addr(group);
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+struct DecoderStats {
+  unsigned long frames = 0;
+  unsigned long samples = 0;
+  unsigned long badFrames = 0;
+  unsigned long seqGaps = 0;
+};
+
+struct SampleWriter {
+  FILE *out = nullptr;
+  DecoderStats stats;
+  bool haveSeq = false;
+  uint32_t lastSeq = 0;
+  uint32_t seqStep = 0; // 1 on serial, the decimation factor on UDP
+
+  // Handles one raw (decoded) frame.
+  void frame(const uint8_t *data, size_t len) {
+    const TelemetrySample *samples;
+    int count = len ? telemetryParseFrame(data, len, &samples) : -1;
+    if (count < 0) {
+      stats.badFrames++;
+      return;
+    }
+    stats.frames++;
+
+    for (int s = 0; s < count; s++) {
+      TelemetrySample sample;
+      memcpy(&sample, &samples[s], sizeof(sample));
+      if (haveSeq) {
+        uint32_t step = sample.seq - lastSeq;
+        if (seqStep == 0) seqStep = step;
+        else if (step != seqStep) stats.seqGaps++;
+      }
+      haveSeq = true;
+      lastSeq = sample.seq;
+      stats.samples++;
+      fprintf(out, "%u,%u,%.3f,%.3f,%.3f,%u,%u\n", sample.seq, sample.timestamp_us,
+              sample.current_mA, sample.voltage_V, sample.setpoint_mA, sample.output, sample.flags);
+    }
+  }
+};
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  const char *output = nullptr;
+  const char *group = "239.255.50.25";
+  int udpPort = 0;
+  long baud = 921600;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      baud = strtol(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+      udpPort = (int)strtol(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      group = argv[++i];
+    } else if (input == nullptr) {
+      input = argv[i];
+    } else {
+      udpPort = 0;
+      input = nullptr;
+      break;
+    }
+  }
+  if ((input == nullptr) == (udpPort == 0)) {
+    fprintf(stderr, "usage: %s <serial-port|capture-file|-> [-b baud] [-o out.csv]\n"
+                    "       %s -u port [-g group] [-o out.csv]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  int fd;
+  if (udpPort != 0) {
+    fd = openMulticast(group, udpPort);
+    if (fd < 0) {
+      fprintf(stderr, "Cannot join %s:%d: %s\n", group, udpPort, strerror(errno));
+      return 1;
+    }
+  } else {
+    fd = strcmp(input, "-") == 0 ? STDIN_FILENO : open(input, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+      fprintf(stderr, "Cannot open %s: %s\n", input, strerror(errno));
+      return 1;
+    }
+    if (isatty(fd) && !configureSerial(fd, baud)) {
+      fprintf(stderr, "Cannot configure %s\n", input);
+      return 1;
+    }
+  }
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (out == nullptr) {
+    fprintf(stderr, "Cannot create %s: %s\n", output, strerror(errno));
+    return 1;
+  }
+  fprintf(out, "seq,timestamp_us,current_mA,voltage_V,setpoint_mA,output,flags\n");
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  SampleWriter writer;
+  writer.out = out;
+  std::vector<uint8_t> encoded;
+  std::vector<uint8_t> decoded;
+  uint8_t buf[4096];
+
+  while (!stopRequested) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+
+    if (udpPort != 0) {
+      // One datagram is one raw frame.
+      writer.frame(buf, (size_t)n);
+      continue;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] != 0) {
+        // Anything longer than the biggest frame is line noise or text.
+        if (encoded.size() < COBS_MAX_ENCODED_SIZE(TELEMETRY_FRAME_SIZE(255))) encoded.push_back(buf[i]);
+        continue;
+      }
+      if (encoded.empty()) continue;
+
+      decoded.resize(encoded.size());
+      size_t len = cobsDecode(encoded.data(), encoded.size(), decoded.data());
+      encoded.clear();
+      writer.frame(decoded.data(), len);
+    }
+  }
+
+  if (out != stdout) fclose(out);
+  if (fd != STDIN_FILENO) close(fd);
+  fprintf(stderr, "frames=%lu samples=%lu bad_frames=%lu seq_gaps=%lu\n",
+          writer.stats.frames, writer.stats.samples, writer.stats.badFrames, writer.stats.seqGaps);
+  return 0;
+}